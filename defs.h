@@ -2,12 +2,17 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct kmemstat;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct schedstat;
+struct rqstat;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct traceev;
 struct superblock;
 
 // bio.c
@@ -40,6 +45,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -65,13 +71,17 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_order(int);
+char*           kalloc_zeroed(void);
+void            kdup(char*);
 void            kfree(char*);
+void            kfree_order(char*, int);
+int             kshared(char*);
+int             getkmemstat(int, struct kmemstat*);
+int             kzero_idle(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
-void*           k_malloc(uint nbytes);
-void            k_free(void *ap);
-
 // kbd.c
 void            kbdintr(void);
 
@@ -81,7 +91,9 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
+void            lapictimer(int);
 void            microdelay(int);
 
 // log.c
@@ -101,6 +113,7 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -109,14 +122,21 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             getpids(uint, int);
+int             getrqstat(int, struct rqstat*);
+int             getschedstat(int, struct schedstat*);
 int             growproc(int);
 int             kill(int);
+void            loadbalance(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+int             resched_pending(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            sched_yield(void);
+int             setaffinity(int, uint);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
@@ -124,6 +144,13 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// slab.c
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            kmem_cache_init(struct kmem_cache*, char*, uint);
+void            slabinit(void);
+uint            slabpages(void);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -153,6 +180,7 @@ char*           strncpy(char*, const char*, int);
 
 // syscall.c
 int             argint(int, int*);
+int             argoutptr(int, char**, int);
 int             argptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
@@ -162,9 +190,16 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// trace.c
+void            traceinit(void);
+void            traceevent(int, int, int);
+int             tracectl(int);
+int             traceread(uint, int);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern uint     tsc_per_tick;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -184,6 +219,8 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowbreak(pde_t*, uint, uint);
+int             cowfault(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -120,18 +121,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   Entries whose ref has fallen to zero stay cached, up to
+//   NINODE of them, so that a later iget() finds them still
+//   valid; beyond that the least recently used one is freed.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,10 +157,11 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache.lock spin-lock protects the list of icache entries
+// and their allocation. Since ip->ref indicates whether an entry
+// is in use, and ip->dev and ip->inum indicate which i-node an
+// entry holds, one must hold icache.lock while using any of
+// those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -166,19 +169,61 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache cache;
+
+  // All cached inodes, through prev/next, the most recently
+  // released first. nfree of them have ref == 0.
+  struct inode head;
+  int nfree;
 } icache;
 
+static void
+icache_unlink(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+static void
+icache_push(struct inode *ip)
+{
+  ip->next = icache.head.next;
+  ip->prev = &icache.head;
+  icache.head.next->prev = ip;
+  icache.head.next = ip;
+}
+
+// Remove and return the least recently used unreferenced inode,
+// or 0 if there is none. Caller must hold icache.lock.
+static struct inode*
+icache_reclaim(void)
+{
+  struct inode *ip;
+
+  for(ip = icache.head.prev; ip != &icache.head; ip = ip->prev){
+    if(ip->ref == 0){
+      icache_unlink(ip);
+      icache.nfree--;
+      return ip;
+    }
+  }
+  return 0;
+}
+
+// Set up the inode cache. Called from main(), before
+// userinit() looks up "/".
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  kmem_cache_init(&icache.cache, "inode", sizeof(struct inode));
+  icache.head.prev = &icache.head;
+  icache.head.next = &icache.head;
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
@@ -242,31 +287,30 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.head.next; ip != &icache.head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        icache.nfree--;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Allocate a new inode cache entry, or recycle an unused one.
+  if((ip = kmem_cache_alloc(&icache.cache)) != 0)
+    initsleeplock(&ip->lock, "inode");
+  else if((ip = icache_reclaim()) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  icache_push(ip);
   release(&icache.lock);
 
   return ip;
@@ -323,8 +367,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// kept for reuse if it is valid, and freed otherwise.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -348,7 +392,18 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    icache_unlink(ip);
+    if(ip->valid){
+      icache_push(ip);
+      if(++icache.nfree > NINODE)
+        ip = icache_reclaim();
+      else
+        ip = 0;
+    }
+    if(ip)
+      kmem_cache_free(&icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -1,38 +1,133 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and blocks of
+// 2^order physically contiguous pages with kalloc_order().
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "kmemstat.h"
 
 void freerange(void *vstart, void *vend);
+static char *kzero_take(int count);
+static int kunref(char *v);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run
 {
   struct run *next;
+  struct run *prev; // only kept for blocks in the buddy lists
+};
+
+// Free memory is managed by a binary buddy allocator: a free block
+// of 2^order pages starts at a page number that is a multiple of
+// 2^order, and its buddy is the block of the same size that it
+// pairs up with into a block of the next order. Freeing a block
+// merges it with its buddy for as long as the buddy is free too,
+// and an allocation splits the smallest free block that is large
+// enough. kmem.order records, for every page that starts a free
+// block, the block's order plus one.
+#define NPAGE (PHYSTOP / PGSIZE)
+#define PFN(v) (V2P(v) / PGSIZE)
+
+// Each CPU keeps a magazine of free pages so that most kalloc() and
+// kfree() calls touch only memory and a lock of their own CPU. A
+// magazine that runs empty is refilled from the buddy allocator,
+// and one that grows past KMAG_SIZE gives back KMAG_BATCH pages, in
+// both cases with a single acquisition of kmem.lock. Pages parked
+// in magazines, or in the pool of zeroed pages, cannot merge with
+// their buddies, so a kalloc_order() that finds no large enough
+// block flushes both and tries again. The magazine's own lock is
+// only ever contended when another CPU has run out of memory and
+// takes pages from it, or when a process migrated between looking
+// up its CPU and taking the lock.
+// Lock order: a magazine lock or kzero.lock, then kmem.lock. No code
+// holds two magazine locks at once.
+#define KMAG_SIZE  32 // pages a magazine holds before draining
+#define KMAG_BATCH 16 // pages moved to or from the free list at once
+
+// kfree() fills freed pages with junk to catch dangling references.
+// That is a second write of every page that is zeroed on allocation
+// anyway; build with -DKALLOC_POISON=0 to leave it out.
+#ifndef KALLOC_POISON
+#define KALLOC_POISON 1
+#endif
+
+// Idle CPUs zero free pages ahead of time and keep up to KZERO_POOL
+// of them here, so that kalloc_zeroed() can usually hand out a page
+// without clearing it.
+#define KZERO_POOL 64
+
+struct kmag
+{
+  struct spinlock lock;
+  struct run *pages;
+  int n;        // number of pages in the magazine
+  uint nalloc;  // pages allocated from this magazine
+  uint nfree;   // pages freed to this magazine
+  uint nrefill; // refills from the buddy allocator
+  uint ndrain;  // batches given back to the buddy allocator
 };
 
 struct
 {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *free[KMEM_NORDER]; // free blocks of each order
+  uint nblock[KMEM_NORDER];      // length of each free list
+  uint npage;       // free pages in all blocks
+  uint nsplit;      // blocks split in two by allocations
+  uint nmerge;      // blocks merged with their buddy when freed
+  uint nflush;      // times all magazines were flushed
+  uint nfail;       // kalloc_order() calls that failed
+  uint nlock;       // acquisitions of lock by the magazines
+  uint ncontended;  // of those, how many found it held
+  uchar order[NPAGE]; // order + 1 of the free block starting at each page
+  struct kmag mag[NCPU];
 } kmem;
 
+struct
+{
+  struct spinlock lock;
+  struct run *pages; // zeroed but for the link in the first word
+  uint n;            // number of pages in the pool
+  uint nhit;         // kalloc_zeroed() calls served from the pool
+  uint nmiss;        // kalloc_zeroed() calls that had to zero a page
+  uint nzeroed;      // pages zeroed by idle CPUs
+} kzero;
+
+// A user page that fork() shares copy-on-write between processes
+// has a reference count; kref.n holds the references beyond the
+// first, so that pages with a single owner need no bookkeeping.
+// kfree() of a page with extra references just drops one.
+struct
+{
+  struct spinlock lock;
+  ushort n[NPAGE];
+  uint nshared;      // pages with extra references
+} kref;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until then there is a single CPU, which uses the buddy allocator
+// directly and without locking.
 void kinit1(void *vstart, void *vend)
 {
+  struct kmag *m;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  initlock(&kref.lock, "kref");
+  for (m = kmem.mag; m < &kmem.mag[NCPU]; m++)
+    initlock(&m->lock, "kmag");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -50,6 +145,193 @@ void freerange(void *vstart, void *vend)
   for (; p + PGSIZE <= (char *)vend; p += PGSIZE)
     kfree(p);
 }
+
+// Remove the free block r of the given order from its list.
+static void buddy_unlink(struct run *r, int order)
+{
+  if (r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if (r->next)
+    r->next->prev = r->prev;
+  kmem.order[PFN(r)] = 0;
+  kmem.nblock[order]--;
+}
+
+static void buddy_link(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if (r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.order[PFN(r)] = order + 1;
+  kmem.nblock[order]++;
+}
+
+// Free the block of 2^order pages at v, merging it with its buddy
+// for as long as that is free too.
+// Caller must hold kmem.lock if kmem.use_lock is set.
+static void buddy_free(char *v, int order)
+{
+  uint pfn, buddy;
+
+  kmem.npage += 1 << order;
+  pfn = PFN(v);
+  while (order < KMEM_NORDER - 1)
+  {
+    buddy = pfn ^ (1 << order);
+    if (buddy >= NPAGE || kmem.order[buddy] != order + 1)
+      break;
+    buddy_unlink((struct run *)P2V(buddy * PGSIZE), order);
+    kmem.nmerge++;
+    pfn &= ~(1 << order);
+    order++;
+  }
+  buddy_link((struct run *)P2V(pfn * PGSIZE), order);
+}
+
+// Allocate a block of 2^order pages, splitting the smallest
+// free block that is large enough. Returns 0 if there is none.
+// Caller must hold kmem.lock if kmem.use_lock is set.
+static char *buddy_alloc(int order)
+{
+  struct run *r;
+  int o;
+
+  for (o = order; o < KMEM_NORDER && kmem.free[o] == 0; o++)
+    ;
+  if (o == KMEM_NORDER)
+    return 0;
+  r = kmem.free[o];
+  buddy_unlink(r, o);
+  while (o > order)
+  {
+    // keep the lower half, free the upper one
+    o--;
+    buddy_link((struct run *)((char *)r + (PGSIZE << o)), o);
+    kmem.nsplit++;
+  }
+  kmem.npage -= 1 << order;
+  return (char *)r;
+}
+
+// Take kmem.lock, counting whether another CPU had it.
+static void kmem_lock(void)
+{
+  int busy = kmem.lock.locked;
+
+  acquire(&kmem.lock);
+  kmem.nlock++;
+  if (busy)
+    kmem.ncontended++;
+}
+
+// Return the magazine of the CPU we are running on, locked.
+// We may be moved to another CPU right after, which is harmless:
+// the lock, not the CPU, protects the magazine.
+static struct kmag *lockmag(void)
+{
+  struct kmag *m;
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  popcli();
+  acquire(&m->lock);
+  return m;
+}
+
+// Move up to KMAG_BATCH pages from the buddy allocator to m,
+// whose lock is held.
+static void refill(struct kmag *m)
+{
+  struct run *r;
+  int i;
+
+  kmem_lock();
+  for (i = 0; i < KMAG_BATCH && (r = (struct run *)buddy_alloc(0)) != 0; i++)
+  {
+    r->next = m->pages;
+    m->pages = r;
+    m->n++;
+  }
+  release(&kmem.lock);
+  m->nrefill++;
+}
+
+// Move KMAG_BATCH pages from m, whose lock is held, to the buddy
+// allocator.
+static void drain(struct kmag *m)
+{
+  struct run *r;
+  int i;
+
+  kmem_lock();
+  for (i = 0; i < KMAG_BATCH; i++)
+  {
+    r = m->pages;
+    m->pages = r->next;
+    buddy_free((char *)r, 0);
+  }
+  release(&kmem.lock);
+  m->n -= KMAG_BATCH;
+  m->ndrain++;
+}
+
+// Give the pages of every magazine and of the zeroed pool back to
+// the buddy allocator, so that they can merge into larger blocks.
+static void flushcaches(void)
+{
+  struct kmag *m;
+  struct run *r;
+
+  acquire(&kzero.lock);
+  kmem_lock();
+  while ((r = kzero.pages) != 0)
+  {
+    kzero.pages = r->next;
+    buddy_free((char *)r, 0);
+  }
+  kzero.n = 0;
+  release(&kmem.lock);
+  release(&kzero.lock);
+
+  for (m = kmem.mag; m < &kmem.mag[NCPU]; m++)
+  {
+    acquire(&m->lock);
+    kmem_lock();
+    while ((r = m->pages) != 0)
+    {
+      m->pages = r->next;
+      buddy_free((char *)r, 0);
+    }
+    release(&kmem.lock);
+    m->n = 0;
+    release(&m->lock);
+  }
+}
+
+// Take a page from any other CPU's magazine; memory is short.
+static struct run *steal_page(void)
+{
+  struct kmag *m;
+  struct run *r = 0;
+
+  for (m = kmem.mag; r == 0 && m < &kmem.mag[NCPU]; m++)
+  {
+    acquire(&m->lock);
+    if ((r = m->pages) != 0)
+    {
+      m->pages = r->next;
+      m->n--;
+      m->nalloc++;
+    }
+    release(&m->lock);
+  }
+  return r;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -58,20 +340,73 @@ void freerange(void *vstart, void *vend)
 void kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
 
   if ((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // Nobody can share a page that has a single owner while that
+  // owner frees it, so there is no need to lock to see that.
+  if (kref.n[PFN(v)] && kunref(v))
+    return;
+
+#if KALLOC_POISON
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if (kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run *)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if (kmem.use_lock)
-    release(&kmem.lock);
+  if (!kmem.use_lock)
+  {
+    buddy_free(v, 0);
+    return;
+  }
+
+  m = lockmag();
+  r->next = m->pages;
+  m->pages = r;
+  m->n++;
+  m->nfree++;
+  if (m->n > KMAG_SIZE)
+    drain(m);
+  release(&m->lock);
+}
+
+// Add a reference to the page v, which kfree() then drops.
+void kdup(char *v)
+{
+  acquire(&kref.lock);
+  if (kref.n[PFN(v)]++ == 0)
+    kref.nshared++;
+  release(&kref.lock);
+}
+
+// Drop a reference to the page v if it has more than one.
+// Returns 1 if it did and the page is still in use.
+static int kunref(char *v)
+{
+  int shared = 0;
+
+  acquire(&kref.lock);
+  if (kref.n[PFN(v)] > 0)
+  {
+    if (--kref.n[PFN(v)] == 0)
+      kref.nshared--;
+    shared = 1;
+  }
+  release(&kref.lock);
+  return shared;
+}
+
+// Is the page v referenced more than once?
+int kshared(char *v)
+{
+  int n;
+
+  acquire(&kref.lock);
+  n = kref.n[PFN(v)];
+  release(&kref.lock);
+  return n > 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -81,125 +416,185 @@ char *
 kalloc(void)
 {
   struct run *r;
+  struct kmag *m;
 
-  if (kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if (r)
-    kmem.freelist = r->next;
-  if (kmem.use_lock)
-    release(&kmem.lock);
+  if (!kmem.use_lock)
+    return buddy_alloc(0);
+
+  m = lockmag();
+  if (m->pages == 0)
+    refill(m);
+  if ((r = m->pages) != 0)
+  {
+    m->pages = r->next;
+    m->n--;
+    m->nalloc++;
+  }
+  release(&m->lock);
+  if (r == 0)
+    r = steal_page();
+  if (r == 0)
+    r = (struct run *)kzero_take(0);
   return (char *)r;
 }
 
-/* cheolho */
+// Allocate 2^order physically contiguous pages, aligned to their
+// size, for 0 <= order < KMEM_NORDER. Free them with kfree_order().
+// Returns 0 if the memory cannot be allocated.
+char *
+kalloc_order(int order)
+{
+  char *v;
 
-typedef long Align;
+  if (order == 0)
+    return kalloc();
+  if (order < 0 || order >= KMEM_NORDER)
+    return 0;
 
-union header {
-  struct
+  if (kmem.use_lock)
+    kmem_lock();
+  v = buddy_alloc(order);
+  if (kmem.use_lock)
+    release(&kmem.lock);
+  if (v == 0 && kmem.use_lock)
   {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
-};
+    // The missing buddies may be sitting in magazines
+    // or in the zeroed pool.
+    flushcaches();
+    kmem_lock();
+    kmem.nflush++;
+    if ((v = buddy_alloc(order)) == 0)
+      kmem.nfail++;
+    release(&kmem.lock);
+  }
+  return v;
+}
+
+// Free a block allocated by kalloc_order(order).
+void kfree_order(char *v, int order)
+{
+  if (order == 0)
+  {
+    kfree(v);
+    return;
+  }
+  if (order < 0 || order >= KMEM_NORDER || (uint)v % (PGSIZE << order) ||
+      v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
 
-typedef union header Header;
+#if KALLOC_POISON
+  memset(v, 1, PGSIZE << order);
+#endif
 
-Header *base_p;
-char *sbrk_addr;
-static Header *freep;
+  if (kmem.use_lock)
+    kmem_lock();
+  buddy_free(v, order);
+  if (kmem.use_lock)
+    release(&kmem.lock);
+}
 
-void k_free(void *ap)
+// Take a page from the pool of zeroed pages, or return 0.
+// The link to the next page is cleared, so the page is all zero.
+// If count is set, the attempt counts as a hit or a miss.
+static char *kzero_take(int count)
 {
-  Header *bp, *p;
+  struct run *r;
 
-  bp = (Header *)ap - 1;
-  for (p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if (p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if (bp + bp->s.size == p->s.ptr)
-  {
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  }
-  else
-    bp->s.ptr = p->s.ptr;
-  if (p + p->s.size == bp)
+  acquire(&kzero.lock);
+  if ((r = kzero.pages) != 0)
   {
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
+    kzero.pages = r->next;
+    kzero.n--;
+    r->next = 0;
   }
-  else
-    p->s.ptr = bp;
-  freep = p;
+  if (count && r)
+    kzero.nhit++;
+  else if (count)
+    kzero.nmiss++;
+  release(&kzero.lock);
+  return (char *)r;
 }
 
-static Header *
-kmorecore(uint nu)
+// Allocate one page of physical memory filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+char *
+kalloc_zeroed(void)
 {
-  char *p;
-  Header *hp;
-  static int first = 1;
+  char *v;
 
-  if (first)
-  {
-    first = 0;
-    if (nu < 4096)
-      nu = 4096;
-    p = sbrk_addr;
-    if (p == (char *)-1)
-      return 0;
-    hp = (Header *)p;
-    hp->s.size = nu;
-    k_free((void *)(hp + 1));
-    return freep;
-  }
-  else
+  // Before kinit2() there is one CPU and no pool; kzero.lock
+  // could not even be taken yet.
+  if (kmem.use_lock && (v = kzero_take(1)) != 0)
+    return v;
+  if ((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one page for the pool if it is not full.
+// Returns 1 if a page was added, 0 otherwise.
+// Called by the scheduler of a CPU that has nothing to run.
+int kzero_idle(void)
+{
+  struct run *r;
+
+  if (!kmem.use_lock || kzero.n >= KZERO_POOL)
+    return 0;
+  if ((r = (struct run *)kalloc()) == 0)
+    return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if (kzero.n >= KZERO_POOL)
   {
+    release(&kzero.lock);
+    kfree((char *)r);
     return 0;
   }
+  r->next = kzero.pages;
+  kzero.pages = r;
+  kzero.n++;
+  kzero.nzeroed++;
+  release(&kzero.lock);
+  return 1;
 }
 
-void *
-k_malloc(uint nbytes)
+// Copy the counters of CPU cpu's page magazine, and those of the
+// buddy allocator, to *st. Returns -1 if there is no such CPU.
+int getkmemstat(int cpu, struct kmemstat *st)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct kmag *m;
+  int i;
 
-  nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
-  if ((prevp = freep) == 0)
-  {
-    int i;
-    for (i = 0; i < 9; i++)
-    {
-      char *temp_p = kalloc();
-      if (i == 7)
-        sbrk_addr = temp_p;
-      if (i == 8)
-        base_p = (Header *)temp_p;
-    }
-    base_p->s.ptr = freep = prevp = base_p;
-    base_p->s.size = 0;
-  }
-  for (p = prevp->s.ptr;; prevp = p, p = p->s.ptr)
-  {
-    if (p->s.size >= nunits)
-    {
-      if (p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else
-      {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void *)(p + 1);
-    }
-    if (p == freep)
-      if ((p = kmorecore(nunits)) == 0)
-        return 0;
-  }
+  if (cpu < 0 || cpu >= ncpu)
+    return -1;
+  m = &kmem.mag[cpu];
+  acquire(&m->lock);
+  st->cpu = cpu;
+  st->nmag = m->n;
+  st->nalloc = m->nalloc;
+  st->nfree = m->nfree;
+  st->nrefill = m->nrefill;
+  st->ndrain = m->ndrain;
+  release(&m->lock);
+  acquire(&kmem.lock);
+  st->nfreepage = kmem.npage;
+  for (i = 0; i < KMEM_NORDER; i++)
+    st->nblock[i] = kmem.nblock[i];
+  st->nsplit = kmem.nsplit;
+  st->nmerge = kmem.nmerge;
+  st->nflush = kmem.nflush;
+  st->nfail = kmem.nfail;
+  st->nlock = kmem.nlock;
+  st->ncontended = kmem.ncontended;
+  release(&kmem.lock);
+  acquire(&kzero.lock);
+  st->nzeropool = kzero.n;
+  st->nzerohit = kzero.nhit;
+  st->nzeromiss = kzero.nmiss;
+  st->nzeroed = kzero.nzeroed;
+  release(&kzero.lock);
+  st->nslab = slabpages();
+  st->nshared = kref.nshared;
+  return 0;
 }
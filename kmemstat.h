@@ -0,0 +1,26 @@
+#define KMEM_NORDER 11  // buddy block sizes: 2^0 .. 2^10 pages (4MB)
+
+// Page allocator counters of one CPU, see getkmemstat().
+// The fields from nfreepage on are global, the same for every CPU.
+struct kmemstat {
+  int cpu;
+  uint nmag;       // Free pages in this CPU's magazine
+  uint nalloc;     // Pages allocated from it
+  uint nfree;      // Pages freed to it
+  uint nrefill;    // Refills from the buddy allocator
+  uint ndrain;     // Batches given back to the buddy allocator
+  uint nfreepage;  // Free pages in the buddy allocator
+  uint nblock[KMEM_NORDER]; // Free blocks of each order
+  uint nsplit;     // Blocks split in two to serve smaller ones
+  uint nmerge;     // Blocks merged with their buddy when freed
+  uint nflush;     // Times kalloc_order() flushed the magazines and zeroed pool
+  uint nfail;      // kalloc_order() calls that failed even then
+  uint nlock;      // Acquisitions of the buddy allocator lock
+  uint ncontended; // Of those, how many had to wait for another CPU
+  uint nzeropool;  // Pages zeroed ahead of time for kalloc_zeroed()
+  uint nzerohit;   // kalloc_zeroed() calls served from that pool
+  uint nzeromiss;  // kalloc_zeroed() calls that had to zero a page
+  uint nzeroed;    // Pages zeroed by idle CPUs
+  uint nslab;      // Pages held by the kernel object caches
+  uint nshared;    // Pages shared copy-on-write by fork()
+};
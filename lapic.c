@@ -64,9 +64,10 @@ lapicinit(void)
   // from lapic[TICR] and then issues an interrupt.
   // If xv6 cared more about precise timekeeping,
   // TICR would be calibrated using an external time source.
+  // xv6 assumes 10000000 counts per 10ms, i.e. a 1GHz bus.
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, 1000000000 / HZ);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +114,32 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Mask or unmask this CPU's timer interrupt. The timer keeps
+// counting while masked; idle CPUs use this to sleep through ticks.
+void
+lapictimer(int on)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, (on ? 0 : MASKED) | PERIODIC | (T_IRQ0 + IRQ_TIMER));
+}
+
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  // Keep an interrupt handler on this CPU from sending
+  // its own IPI between the two ICR writes.
+  pushcli();
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+  popcli();
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
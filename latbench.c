@@ -0,0 +1,212 @@
+// Latency microbenchmarks for the context switch, system call,
+// yield, sleep/wakeup and process creation paths.
+// Usage: latbench [test...]
+// Runs the named tests, or all of them, timing every operation
+// with rdtsc and printing the min, median and 99th percentile
+// in cycles. The "rdtsc" test measures the timing overhead itself.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define NSAMPLE 2000
+#define CHILDARG "-exit"  // argument that makes the exec'd child exit
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+uint samples[NSAMPLE];
+char *self;
+
+// Sort the first n samples (Shell sort).
+static void
+sortsamples(int n)
+{
+  int gap, i, j;
+  uint v;
+
+  for(gap = n/2; gap > 0; gap /= 2){
+    for(i = gap; i < n; i++){
+      v = samples[i];
+      for(j = i; j >= gap && samples[j-gap] > v; j -= gap)
+        samples[j] = samples[j-gap];
+      samples[j] = v;
+    }
+  }
+}
+
+static void
+report(char *name, int n)
+{
+  sortsamples(n);
+  printf(1, "%s\t%d\t%d\t%d\t%d\n", name, n,
+         samples[0], samples[n/2], samples[n*99/100]);
+}
+
+static void
+bench_rdtsc(int n)
+{
+  unsigned long long t0;
+  int i;
+
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    samples[i] = rdtsc() - t0;
+  }
+}
+
+// getpid() does nothing but enter and leave the kernel.
+static void
+bench_syscall(int n)
+{
+  unsigned long long t0;
+  int i;
+
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    getpid();
+    samples[i] = rdtsc() - t0;
+  }
+}
+
+// A yield with nothing else to run still goes through
+// the scheduler and back.
+static void
+bench_yield(int n)
+{
+  unsigned long long t0;
+  int i;
+
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    yield();
+    samples[i] = rdtsc() - t0;
+  }
+}
+
+// One byte to a child and back: two sleep/wakeup
+// round trips and at least two context switches.
+static void
+bench_pipe(int n)
+{
+  unsigned long long t0;
+  int i, pid, to[2], from[2];
+  char c = 0;
+
+  if(pipe(to) < 0 || pipe(from) < 0){
+    printf(2, "latbench: pipe failed\n");
+    exit();
+  }
+  if((pid = fork()) < 0){
+    printf(2, "latbench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(to[1]);
+    close(from[0]);
+    while(read(to[0], &c, 1) == 1)
+      write(from[1], &c, 1);
+    exit();
+  }
+  close(to[0]);
+  close(from[1]);
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    write(to[1], &c, 1);
+    read(from[0], &c, 1);
+    samples[i] = rdtsc() - t0;
+  }
+  close(to[1]);
+  close(from[0]);
+  wait();
+}
+
+static void
+bench_fork(int n)
+{
+  unsigned long long t0;
+  int i, pid;
+
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    if((pid = fork()) == 0)
+      exit();
+    if(pid < 0){
+      printf(2, "latbench: fork failed\n");
+      exit();
+    }
+    wait();
+    samples[i] = rdtsc() - t0;
+  }
+}
+
+static void
+bench_exec(int n)
+{
+  unsigned long long t0;
+  int i, pid;
+  char *argv[] = { self, CHILDARG, 0 };
+
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    if((pid = fork()) == 0){
+      exec(self, argv);
+      printf(2, "latbench: exec %s failed\n", self);
+      exit();
+    }
+    if(pid < 0){
+      printf(2, "latbench: fork failed\n");
+      exit();
+    }
+    wait();
+    samples[i] = rdtsc() - t0;
+  }
+}
+
+struct test {
+  char *name;
+  void (*fn)(int);
+  int n;
+} tests[] = {
+  { "rdtsc",     bench_rdtsc,   NSAMPLE },
+  { "syscall",   bench_syscall, NSAMPLE },
+  { "yield",     bench_yield,   NSAMPLE },
+  { "pipe",      bench_pipe,    NSAMPLE },
+  { "fork",      bench_fork,    200 },
+  { "forkexec",  bench_exec,    100 },
+};
+
+static void
+run(struct test *t)
+{
+  t->fn(t->n);
+  report(t->name, t->n);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct test *t;
+  int i;
+
+  if(argc == 2 && strcmp(argv[1], CHILDARG) == 0)
+    exit();
+  self = argv[0];
+
+  printf(1, "test\tn\tmin\tmedian\tp99 (cycles)\n");
+  if(argc < 2){
+    for(t = tests; t < &tests[NELEM(tests)]; t++)
+      run(t);
+    exit();
+  }
+  for(i = 1; i < argc; i++){
+    for(t = tests; t < &tests[NELEM(tests)]; t++)
+      if(strcmp(argv[i], t->name) == 0)
+        break;
+    if(t == &tests[NELEM(tests)]){
+      printf(2, "latbench: unknown test %s\n", argv[i]);
+      exit();
+    }
+    run(t);
+  }
+  exit();
+}
@@ -0,0 +1,44 @@
+// Print the page allocator counters of every CPU, then the
+// state of the buddy allocator. For each block order, "unusable"
+// is the share of free memory that lies in smaller blocks and so
+// cannot serve an allocation of that order: 0% means no
+// fragmentation, 100% that the order cannot be allocated at all.
+// Usage: memstat
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kmemstat.h"
+
+int
+main(void)
+{
+  struct kmemstat st;
+  int cpu, i;
+  uint small;
+
+  printf(1, "cpu\tfree\talloc\tfreed\trefill\tdrain\n");
+  for(cpu = 0; getkmemstat(cpu, &st) == 0; cpu++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\n", st.cpu, st.nmag, st.nalloc,
+           st.nfree, st.nrefill, st.ndrain);
+  if(cpu == 0){
+    printf(2, "memstat: getkmemstat failed\n");
+    exit();
+  }
+  printf(1, "buddy: %d free pages, lock taken %d times, %d contended\n",
+         st.nfreepage, st.nlock, st.ncontended);
+  printf(1, "order\tkbytes\tfree\tunusable\n");
+  small = 0;
+  for(i = 0; i < KMEM_NORDER; i++){
+    printf(1, "%d\t%d\t%d\t%d%%\n", i, 4 << i, st.nblock[i],
+           st.nfreepage ? small * 100 / st.nfreepage : 0);
+    small += st.nblock[i] << i;
+  }
+  printf(1, "%d splits, %d merges, %d flushes, %d failures\n",
+         st.nsplit, st.nmerge, st.nflush, st.nfail);
+  printf(1, "zeroed pool: %d pages, %d zeroed while idle, %d hits, %d misses\n",
+         st.nzeropool, st.nzeroed, st.nzerohit, st.nzeromiss);
+  printf(1, "object caches: %d pages\n", st.nslab);
+  printf(1, "copy-on-write: %d shared pages\n", st.nshared);
+  exit();
+}
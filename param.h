@@ -1,9 +1,11 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       256  // maximum number of processes
+#define NSTRIDEGROUP 16  // maximum number of stride scheduling groups
+#define HZ          100  // timer interrupts per second
+#define MAXQUANTUM   HZ  // longest scheduling quantum, in ticks
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // unreferenced i-nodes kept in the i-node cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
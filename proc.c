@@ -6,20 +6,113 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "schedstat.h"
+#include "slab.h"
+#include "trace.h"
 
-#define STRIDE_LARGE_NUMBER 10000
+#define NSLEEPHASH 64 // number of sleep-channel hash buckets (power of 2)
+#define NPIDHASH   64 // number of pid hash buckets (power of 2)
 
 struct proc proc;
 
+// Locking:
+// ptable.lock protects the process list, pids, parent links and
+// the SLEEPING/ZOMBIE transitions that sleep/wakeup and wait/exit
+// rely on. Each CPU's run queue has its own lock, which protects
+// the heap and the RUNNABLE/RUNNING transitions of the processes
+// it owns, and which is held across swtch() between a process and
+// its CPU's scheduler. ptable.lock may be held while acquiring a
+// run queue lock, never the other way around, and no code holds
+// two run queue locks at once.
+// A stride group is a ticket currency: its own tickets, counted in
+// its parent's currency (or base tickets at the root), are shared
+// among its active member processes and child groups in proportion
+// to their tickets. A process is active while it is a client of a
+// run queue, from stride_join() to stride_leave(), that is while it
+// is RUNNABLE or RUNNING; a group is active while it has an active
+// member. Members that sleep thus deflate the currency and leave
+// its whole funding to those that want the CPU. Groups are protected
+// by ptable.lock, except that the active sums are kept under
+// ptable.glock so that the schedulers can update them.
+struct stride_group
+{
+  int gid;                     // Group ID, 0 if the slot is free
+  int tickets;                 // Funding in the parent's currency
+  int active_tickets;          // Sum of tickets of active members and child groups
+  int nactive;                 // Number of those
+  int nmembers;                // Number of member processes and child groups
+  struct stride_group *parent; // Enclosing group, 0 for the root
+  int gang;                    // Co-schedule the member processes?
+  volatile uint gang_until;    // ticks at which the gang's time slice ends
+  struct list_head queued[NCPU]; // Members queued per CPU, under its rq lock
+};
+
+// A scheduling policy decides in which order the stride-class clients
+// of a run queue run. All policies share the client accounting of
+// stride_join()/stride_leave() and keep the queued processes in
+// rq->heap[0..size) with their slot in p->rq_index, so that steal()
+// works with any of them and the policy can be switched while
+// processes are queued. Every hook is called with rq->lock held.
+struct sched_policy
+{
+  char *name;
+  void (*insert)(struct runqueue *rq, struct proc *p); // queue p
+  struct proc *(*pick)(struct runqueue *rq);           // dequeue the next to run, or NULL
+  void (*remove)(struct runqueue *rq, struct proc *p); // dequeue p
+  void (*charge)(struct runqueue *rq, struct proc *p, uint charge); // p ran for charge
+  int (*preempts)(struct runqueue *rq, struct proc *p, struct proc *cur); // should waking p preempt cur?
+};
+
 struct
 {
   struct spinlock lock;
   struct list_head queue_head;
+  int nproc;                // number of allocated processes
+  struct hlist_head sleepq[NSLEEPHASH]; // SLEEPING processes hashed by chan
+  struct hlist_head pidhash[NPIDHASH];  // all processes hashed by pid
   /* stride scheduling */
   int large_number;         // a large number required for stride scheduling
-  long long min_pass_value; // system-wide lowest pass value
+  struct stride_group groups[NSTRIDEGROUP]; // gid is index + 1
+  struct spinlock glock;    // protects the active sums of the groups
+  uint group_gen;           // bumped after any change that affects funding
 } ptable;
 
+// struct proc is allocated from this cache by allocproc().
+static struct kmem_cache proccache;
+
+// Per-CPU run queue of RUNNABLE processes, kept as a binary min-heap
+// ordered by stride_info.pass_value so that heap[0] is always the
+// next process to run. A process is only ever queued on the run
+// queue of p->cpu.
+// global_pass and tickets follow Waldspurger's stride scheduling:
+// tickets is the sum over the CPU's RUNNABLE and RUNNING processes,
+// and global_pass advances by STRIDE_ONE / tickets every quantum.
+// Which client runs next is up to the run queue's scheduling policy
+// (see struct sched_policy): stride keeps the heap ordered by pass,
+// lottery draws from it at random, weighted through rq->fenwick.
+// Real-time processes (p->rtprio > 0) are not stride clients: they
+// wait in one FIFO list per priority and run before any process in
+// the heap, as long as they have not used up RT_RUNTIME this period.
+struct runqueue
+{
+  struct spinlock lock;
+  struct sched_policy *policy; // Orders and picks the processes in heap
+  struct proc *heap[NPROC]; // heap[0] has the lowest pass value (stride)
+  int size;                 // Number of processes in heap
+  uint fenwick[NPROC + 1];  // Fenwick tree over heap[i]'s funding (lottery)
+  uint seed;                // Random state for lottery draws
+  int tickets;              // Global tickets of this CPU
+  long long global_pass;    // Global pass of this CPU
+  struct list_head rt[RT_NPRIO]; // RUNNABLE real-time processes, by rtprio - 1
+  int nrt;                  // Number of processes in the rt lists
+  uint rt_used;             // Real-time CPU time this period, in charge units
+  uint rt_period;           // ticks when the current period started
+  uint next_balance;        // ticks at which loadbalance() looks again
+  uint nsteals;             // Processes taken by steal() while idle
+  uint nbalanced;           // Processes pulled over by loadbalance()
+} runqueues[NCPU];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -27,132 +120,1273 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void refresh_funding(struct runqueue *rq, struct proc *p, int client);
+
+// Return the sleep-queue bucket for chan. Channels are
+// kernel addresses, so drop the low alignment bits and
+// fold in higher bits before masking.
+static struct hlist_head *sleepq_bucket(void *chan)
+{
+  uint h = (uint)chan;
+
+  h = (h >> 4) ^ (h >> 12);
+  return &ptable.sleepq[h & (NSLEEPHASH - 1)];
+}
+
+// Return the process with the given pid, or 0.
+// Pids are handed out sequentially, so the low bits
+// spread them evenly over the buckets.
+// The ptable lock must be held.
+static struct proc *findproc(int pid)
+{
+  struct proc *p;
+
+  hlist_for_each_entry(p, &ptable.pidhash[pid & (NPIDHASH - 1)], pid_elem)
+  {
+    if (p->pid == pid)
+      return p;
+  }
+  return 0;
+}
 
 /* stride scheduling */
 
-/* Remove and return a process that is RUNNABLE and has the lowest pass value from the queue.
-   If there is no such a process, the function returns NULL.
+/* Swap two heap slots and keep each process' rq_index in sync.
+*/
+static void heap_swap(struct runqueue *rq, int i, int j)
+{
+  struct proc *tmp = rq->heap[i];
+
+  rq->heap[i] = rq->heap[j];
+  rq->heap[j] = tmp;
+  rq->heap[i]->rq_index = i;
+  rq->heap[j]->rq_index = j;
+}
+
+/* Move the process at slot i towards the root until its parent
+   has a pass value that is not larger than its own.
+*/
+static void heap_sift_up(struct runqueue *rq, int i)
+{
+  int parent;
+
+  while (i > 0)
+  {
+    parent = (i - 1) / 2;
+    if (rq->heap[parent]->stride_info.pass_value <= rq->heap[i]->stride_info.pass_value)
+      break;
+    heap_swap(rq, i, parent);
+    i = parent;
+  }
+}
+
+/* Move the process at slot i towards the leaves until both of its
+   children have pass values that are not smaller than its own.
+*/
+static void heap_sift_down(struct runqueue *rq, int i)
+{
+  int child;
+
+  for (;;)
+  {
+    child = 2 * i + 1;
+    if (child >= rq->size)
+      break;
+    // pick the smaller child
+    if (child + 1 < rq->size &&
+        rq->heap[child + 1]->stride_info.pass_value < rq->heap[child]->stride_info.pass_value)
+      child++;
+    if (rq->heap[i]->stride_info.pass_value <= rq->heap[child]->stride_info.pass_value)
+      break;
+    heap_swap(rq, i, child);
+    i = child;
+  }
+}
+
+/* Remove and return the process at slot i of the run queue.
+*/
+static struct proc *heap_remove(struct runqueue *rq, int i)
+{
+  struct proc *p = rq->heap[i];
+
+  rq->size--;
+  if (i < rq->size)
+  {
+    // move the last leaf into the hole and restore heap order
+    rq->heap[i] = rq->heap[rq->size];
+    rq->heap[i]->rq_index = i;
+    heap_sift_down(rq, i);
+    heap_sift_up(rq, i);
+  }
+  rq->heap[rq->size] = NULL;
+  p->rq_index = -1;
+
+  return p;
+}
+
+/* Remove and return the RUNNABLE process with the lowest pass value from the run queue.
+   If the run queue is empty, the function returns NULL.
+   This function is called from scheduler().
+*/
+struct proc *remove_min(struct runqueue *rq)
+{
+  if (rq->size == 0)
+    return NULL;
+
+  // the root of the heap has the lowest pass value
+  return heap_remove(rq, 0);
+}
+
+/* Convert TSC cycles spent running a process into a charge in
+   units of 1/STRIDE_CHARGE_TICK timer ticks. Until the TSC has been
+   measured against the timer every run is charged one full tick.
+   Runs are capped at two maximum quanta to keep the arithmetic in
+   range; only a process that kept interrupts off that long gets less.
    This function is called from scheduler().
 */
-struct proc *remove_min(struct list_head *head)
+static uint quantum_charge(unsigned long long cycles)
+{
+  uint per_tick = tsc_per_tick;
+
+  if (per_tick == 0)
+    return STRIDE_CHARGE_TICK;
+  if (cycles > (unsigned long long)per_tick * 2 * MAXQUANTUM)
+    cycles = (unsigned long long)per_tick * 2 * MAXQUANTUM;
+  return divl64(cycles << STRIDE_CHARGE_SHIFT, per_tick);
+}
+
+/* Update the process' pass value after a run by the scheduler.
+   The process is charged its stride for every tick's worth of
+   CPU time it used, so one that yields early pays only a fraction.
+   This function is called from scheduler().
+*/
+void update_pass_value(struct proc *proc, uint charge)
+{
+  proc->stride_info.pass_value +=
+      ((unsigned long long)proc->stride_info.stride * charge) >> STRIDE_CHARGE_SHIFT;
+}
+
+/* Advance the run queue's global pass by the global stride,
+   STRIDE_ONE / global tickets, for every tick's worth of CPU time
+   that the last process used.
+   This function is called from scheduler().
+*/
+void update_global_pass(struct runqueue *rq, uint charge)
+{
+  if (rq->tickets > 0)
+    rq->global_pass += ((unsigned long long)(STRIDE_ONE / rq->tickets) * charge) >> STRIDE_CHARGE_SHIFT;
+}
+
+// Note that a group's funding may have changed. Must be called
+// after the group fields have been updated.
+static void group_changed(void)
+{
+  __sync_synchronize();
+  __sync_fetch_and_add(&ptable.group_gen, 1);
+}
+
+/* Add tickets to the active sum of group g, and n (1, -1 or 0) to
+   its count of active members. If that turns g active or inactive,
+   g's own tickets are added to or removed from its parent's sum in
+   the same way, and so on up. The caller must hold ptable.glock.
+*/
+static void group_active(struct stride_group *g, int tickets, int n)
+{
+  while (g != 0)
+  {
+    g->active_tickets += tickets;
+    g->nactive += n;
+    if (n == 0 || g->nactive != (n > 0 ? 1 : 0))
+      break;
+    tickets = n * g->tickets;
+    g = g->parent;
+  }
+}
+
+// Count p in (n = 1) or out (n = -1) of the active members of its
+// group, if it has one and is not already counted so.
+static void proc_active(struct proc *p, int n)
+{
+  if (p->stride_info.active == (n > 0))
+    return;
+  p->stride_info.active = n > 0;
+  if (p->group == 0)
+    return;
+  acquire(&ptable.glock);
+  group_active(p->group, n * p->stride_info.tickets, n);
+  release(&ptable.glock);
+  group_changed();
+}
+
+/* Add a process to the run queue's set of competing clients.
+   Its pass is restored from the remain it saved when it left,
+   so it keeps whatever credit or debt it had.
+   The caller must hold rq->lock and then insert() the process.
+   This function is called from make_runnable() and steal().
+*/
+void stride_join(struct runqueue *rq, struct proc *proc)
+{
+  proc_active(proc, 1);
+  refresh_funding(rq, proc, 0);
+  rq->tickets += proc->stride_info.funding;
+  proc->stride_info.pass_value = rq->global_pass + proc->stride_info.remain;
+}
+
+/* Remove a process from the run queue's set of competing clients and
+   save how far its pass is from the global pass.
+   The caller must hold rq->lock.
+   This function is called from scheduler() and steal().
+*/
+void stride_leave(struct runqueue *rq, struct proc *proc)
+{
+  proc->stride_info.remain = proc->stride_info.pass_value - rq->global_pass;
+  rq->tickets -= proc->stride_info.funding;
+  proc_active(proc, -1);
+}
+
+/* Rescale a remain computed with old_stride to new_stride, so that a
+   ticket change keeps the same fraction of the current stride left.
+   A client is never much more than a stride away from the global
+   pass; clamping to that keeps the 64/32-bit division in range.
+*/
+static long long scale_remain(long long remain, uint old_stride, uint new_stride)
+{
+  if (remain > old_stride)
+    remain = old_stride;
+  if (remain < -(long long)old_stride)
+    remain = -(long long)old_stride;
+
+  if (remain >= 0)
+    return divl64((unsigned long long)remain * new_stride, old_stride);
+  return -(long long)divl64((unsigned long long)-remain * new_stride, old_stride);
+}
+
+/* Convert a process' tickets into base tickets by walking up its groups.
+   At each level the tickets become their share of the group's funding.
+   Group fields are read without ptable.lock; whoever changes them bumps
+   ptable.group_gen afterwards, so a torn read is redone by refresh_funding().
+*/
+static int compute_funding(struct proc *p)
+{
+  struct stride_group *g;
+  uint t = p->stride_info.tickets;
+  int members;
+
+  for (g = p->group; g != 0; g = g->parent)
+  {
+    members = g->active_tickets;
+    // we are part of the active sum, so the quotient stays <= g->tickets
+    if (members < (int)t)
+      members = t;
+    t = divl64((unsigned long long)t * g->tickets, members);
+  }
+  if (t < 1)
+    t = 1;
+  return t;
+}
+
+/* Give a process new funding and the stride that goes with it.
+   If the process is one of rq's clients, the global tickets and the
+   process' pass follow; otherwise only its saved remain is rescaled.
+   The caller must hold rq->lock.
+*/
+static void set_funding(struct runqueue *rq, struct proc *p, int funding, int client)
+{
+  uint stride;
+
+  if (funding == p->stride_info.funding)
+    return;
+
+  stride = STRIDE_ONE / funding;
+  if (client)
+  {
+    rq->tickets += funding - p->stride_info.funding;
+    p->stride_info.pass_value = rq->global_pass +
+        scale_remain(p->stride_info.pass_value - rq->global_pass, p->stride_info.stride, stride);
+  }
+  else
+  {
+    p->stride_info.remain = scale_remain(p->stride_info.remain, p->stride_info.stride, stride);
+  }
+  p->stride_info.funding = funding;
+  p->stride_info.stride = stride;
+}
+
+/* Recompute a process' funding if any group changed since the last time.
+   The caller must hold rq->lock.
+   This function is called from scheduler() and stride_join().
+*/
+static void refresh_funding(struct runqueue *rq, struct proc *p, int client)
+{
+  uint gen = ptable.group_gen;
+
+  if (p->stride_info.group_gen == gen)
+    return;
+  p->stride_info.group_gen = gen;
+  __sync_synchronize();
+  set_funding(rq, p, compute_funding(p), client);
+}
+
+/* Rebase all pass values of the run queue on its global pass once that
+   grows past STRIDE_RENORM_PASS, so pass values never overflow however
+   long the system runs. Subtracting the same amount from every queued
+   process keeps the heap order and every process' lag intact.
+   Processes of this CPU that are not queued keep their pass relative
+   to the global pass in remain, so they need no fixup.
+   This function is called from scheduler().
+*/
+static void renormalize_pass_values(struct runqueue *rq)
+{
+  long long base = rq->global_pass;
+  int i;
+
+  if (base < STRIDE_RENORM_PASS)
+    return;
+  for (i = 0; i < rq->size; i++)
+    rq->heap[i]->stride_info.pass_value -= base;
+  rq->global_pass = 0;
+}
+
+/* Insert a RUNNABLE process into the run queue.
+   This function is called from scheduler(), fork(), wakeup1(), kill() and userinit().
+*/
+void insert(struct runqueue *rq, struct proc *current)
+{
+  if (current->rq_index >= 0)
+    panic("insert: already queued");
+  if (rq->size >= NPROC)
+    panic("insert: runqueue full");
+
+  current->rq_index = rq->size;
+  rq->heap[rq->size++] = current;
+  heap_sift_up(rq, current->rq_index);
+}
+
+/* Queue a RUNNABLE real-time process on rq, at the head of its
+   priority's list if it was preempted, so that it keeps its place,
+   and at the tail otherwise.
+*/
+static void rt_enqueue(struct runqueue *rq, struct proc *p, int head)
+{
+  if (head)
+    list_add(&p->rt_elem, &rq->rt[p->rtprio - 1]);
+  else
+    list_add_tail(&p->rt_elem, &rq->rt[p->rtprio - 1]);
+  rq->nrt++;
+}
+
+static void rt_dequeue(struct runqueue *rq, struct proc *p)
+{
+  list_del_init(&p->rt_elem);
+  rq->nrt--;
+}
+
+/* Remove and return the first process of the highest non-empty
+   real-time priority, or NULL.
+*/
+static struct proc *rt_pick(struct runqueue *rq)
+{
+  struct proc *p;
+  int prio;
+
+  for (prio = RT_NPRIO - 1; prio >= 0; prio--)
+  {
+    if (list_empty(&rq->rt[prio]))
+      continue;
+    p = list_first_entry(&rq->rt[prio], struct proc, rt_elem);
+    rt_dequeue(rq, p);
+    return p;
+  }
+  return NULL;
+}
+
+/* Return whether real-time processes have used up their share of
+   this CPU for the current period of HZ ticks, starting a new period
+   if the old one is over. The caller must hold rq->lock.
+*/
+static int rt_throttled(struct runqueue *rq)
+{
+  if (ticks - rq->rt_period >= HZ)
+  {
+    rq->rt_period = ticks;
+    rq->rt_used = 0;
+  }
+  return rq->rt_used >= RT_RUNTIME;
+}
+
+/* Gang scheduling: the member processes of a stride group marked as
+   a gang are dispatched together. When a CPU picks a member by the
+   usual rules, the gang becomes active for that member's quantum and
+   every other CPU with a member queued is interrupted to run it right
+   away (see gang_activate). Members are charged as usual, so running
+   early costs them pass, and it is still the combined tickets of the
+   group that decide how often the gang comes up.
+*/
+static volatile uint gang_until; // no gang is active from this tick on
+
+// Return whether g is a gang within its active time slice.
+static int gang_active(struct stride_group *g)
+{
+  return g != 0 && g->gang && (int)(g->gang_until - ticks) > 0;
+}
+
+// Add p to (delta 1) or remove it from (delta -1) the members of its
+// group queued on rq, so that gang_pick() finds them without looking
+// through the whole heap and gang_activate() knows which CPUs to kick.
+// The caller must hold rq->lock.
+static void gang_count(struct runqueue *rq, struct proc *p, int delta)
+{
+  if (p->group == 0)
+    return;
+  if (delta > 0)
+    list_add_tail(&p->gang_elem, &p->group->queued[rq - runqueues]);
+  else
+    list_del_init(&p->gang_elem);
+}
+
+// Remove and return the lowest-pass process on rq that belongs to an
+// active gang, or NULL. The caller must hold rq->lock.
+static struct proc *gang_pick(struct runqueue *rq)
+{
+  struct stride_group *g;
+  struct proc *p, *best = NULL;
+  int cpu = rq - runqueues;
+
+  if ((int)(gang_until - ticks) <= 0)
+    return NULL;
+  for (g = ptable.groups; g < &ptable.groups[NSTRIDEGROUP]; g++)
+  {
+    if (!gang_active(g))
+      continue;
+    list_for_each_entry(p, &g->queued[cpu], gang_elem)
+    {
+      if (best == NULL || p->stride_info.pass_value < best->stride_info.pass_value)
+        best = p;
+    }
+  }
+  if (best != NULL)
+    rq->policy->remove(rq, best);
+  return best;
+}
+
+/* Queue a RUNNABLE process that is on no run queue on rq, in its
+   scheduling class. The caller must hold rq->lock.
+*/
+static void enqueue(struct runqueue *rq, struct proc *p)
+{
+  if (p->rtprio)
+  {
+    rt_enqueue(rq, p, 0);
+    return;
+  }
+  stride_join(rq, p);
+  rq->policy->insert(rq, p);
+  gang_count(rq, p, 1);
+}
+
+/* Remove and return the process rq's CPU should run next: the first
+   real-time process unless they are throttled, then a member of an
+   active gang, then the client chosen by the scheduling policy.
+   Throttled real-time processes still run if there is nothing else
+   to do.
+*/
+static struct proc *pick_next(struct runqueue *rq)
+{
+  struct proc *p;
+
+  if (rq->nrt > 0 && (rq->size == 0 || !rt_throttled(rq)))
+    return rt_pick(rq);
+  if ((p = gang_pick(rq)) == NULL)
+    p = rq->policy->pick(rq);
+  if (p != NULL)
+    gang_count(rq, p, -1);
+  return p;
+}
+
+/* Stride policy hooks for the functions above.
+*/
+static void stride_remove(struct runqueue *rq, struct proc *p)
+{
+  heap_remove(rq, p->rq_index);
+}
+
+static void stride_charge(struct runqueue *rq, struct proc *p, uint charge)
+{
+  update_pass_value(p, charge);
+  update_global_pass(rq, charge);
+}
+
+// A waking process preempts only if its pass is lower by more than
+// STRIDE_WAKEUP_GAP, so that ordinary wakeups wait for the next tick.
+static int stride_preempts(struct runqueue *rq, struct proc *p, struct proc *cur)
+{
+  return p->stride_info.pass_value + STRIDE_WAKEUP_GAP < cur->stride_info.pass_value;
+}
+
+static struct sched_policy stride_policy = {
+    "stride", insert, remove_min, stride_remove, stride_charge, stride_preempts};
+
+/* Lottery scheduling: every queued client holds its funding in
+   tickets and the next one to run is drawn at random in proportion
+   to them. rq->heap is kept unordered, and rq->fenwick is a Fenwick
+   (binary indexed) tree over the funding of heap[0..size), so that
+   inserting, removing and drawing each take O(log n). Funding only
+   changes while a process is not queued, so what was added for a
+   slot is still its funding when it is taken out.
+*/
+static void fenwick_add(struct runqueue *rq, int i, uint delta)
+{
+  for (i++; i <= NPROC; i += i & -i)
+    rq->fenwick[i] += delta;
+}
+
+// Return the total funding of heap[0..n).
+static uint fenwick_sum(struct runqueue *rq, int n)
+{
+  uint sum = 0;
+
+  for (; n > 0; n -= n & -n)
+    sum += rq->fenwick[n];
+  return sum;
+}
+
+// Return the slot that holds ticket r, counting tickets from heap[0].
+static int fenwick_find(struct runqueue *rq, uint r)
+{
+  int i = 0, step = 1;
+
+  while (step * 2 <= NPROC)
+    step *= 2;
+  for (; step > 0; step /= 2)
+  {
+    if (i + step <= NPROC && rq->fenwick[i + step] <= r)
+    {
+      i += step;
+      r -= rq->fenwick[i];
+    }
+  }
+  return i;
+}
+
+// xorshift32; good enough to draw lottery tickets.
+static uint lottery_rand(struct runqueue *rq)
+{
+  uint x = rq->seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  rq->seed = x;
+  return x;
+}
+
+static void lottery_insert(struct runqueue *rq, struct proc *p)
+{
+  if (p->rq_index >= 0)
+    panic("insert: already queued");
+  if (rq->size >= NPROC)
+    panic("insert: runqueue full");
+
+  p->rq_index = rq->size;
+  rq->heap[rq->size++] = p;
+  fenwick_add(rq, p->rq_index, p->stride_info.funding);
+}
+
+// Take p out and fill its slot with the last process.
+static void lottery_remove(struct runqueue *rq, struct proc *p)
+{
+  struct proc *last;
+  int i = p->rq_index;
+
+  fenwick_add(rq, i, -p->stride_info.funding);
+  rq->size--;
+  if (i < rq->size)
+  {
+    last = rq->heap[rq->size];
+    fenwick_add(rq, rq->size, -last->stride_info.funding);
+    rq->heap[i] = last;
+    last->rq_index = i;
+    fenwick_add(rq, i, last->stride_info.funding);
+  }
+  rq->heap[rq->size] = NULL;
+  p->rq_index = -1;
+}
+
+static struct proc *lottery_pick(struct runqueue *rq)
+{
+  struct proc *p;
+  uint total;
+
+  if (rq->size == 0)
+    return NULL;
+  total = fenwick_sum(rq, rq->size);
+  p = rq->heap[fenwick_find(rq, lottery_rand(rq) % total)];
+  lottery_remove(rq, p);
+  return p;
+}
+
+// Lottery needs no pass: a process' chance of winning the next draw
+// does not depend on how long it ran. Passes stay where they were,
+// so clients keep their lag if the policy is switched back to stride.
+static void lottery_charge(struct runqueue *rq, struct proc *p, uint charge)
+{
+}
+
+// A woken client waits for the next draw.
+static int lottery_preempts(struct runqueue *rq, struct proc *p, struct proc *cur)
+{
+  return 0;
+}
+
+static struct sched_policy lottery_policy = {
+    "lottery", lottery_insert, lottery_pick, lottery_remove, lottery_charge, lottery_preempts};
+
+static struct sched_policy *policies[] = {
+    [SCHED_STRIDE] &stride_policy,
+    [SCHED_LOTTERY] &lottery_policy,
+};
+
+// Return the run queue of the CPU we are running on.
+// Must be called with interrupts disabled.
+static struct runqueue *myrq(void)
+{
+  return &runqueues[cpuid()];
+}
+
+// Acquire the lock of this CPU's run queue and return it.
+// Interrupts stay disabled while the lock is held,
+// so the caller cannot migrate to another CPU.
+static struct runqueue *lockmyrq(void)
+{
+  struct runqueue *rq;
+
+  pushcli();
+  rq = myrq();
+  acquire(&rq->lock);
+  popcli();
+  return rq;
+}
+
+// Wake a CPU halted in idle() so that it looks at the run queues
+// again after a process was queued on runqueues[cpu]: that CPU if
+// it is idle, otherwise an idle CPU whose bit is set in allowed,
+// the process's affinity mask, which will steal the process.
+// If preempt is set, that CPU's running process should make way
+// for the new one, so it is interrupted even though it is busy.
+// Must be called with interrupts disabled.
+static void kick_cpu(int cpu, int preempt, uint allowed)
+{
+  struct cpu *c;
+
+  if (preempt)
+  {
+    // We are that CPU: trap() will yield on the way out.
+    if (cpu == cpuid())
+      return;
+  }
+  else if (!cpus[cpu].idle)
+  {
+    for (c = cpus; c < &cpus[ncpu]; c++)
+      if (c->idle && ((allowed >> (c - cpus)) & 1))
+        break;
+    if (c == &cpus[ncpu])
+      return;
+    cpu = c - cpus;
+  }
+  lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Decide whether newly queued p should preempt the process running
+// on rq's CPU, as real-time priorities or the scheduling policy say.
+// The caller must hold rq->lock, which keeps the running process
+// and its pass stable.
+static int wakeup_preempts(struct runqueue *rq, struct proc *p)
+{
+  struct cpu *c = &cpus[rq - runqueues];
+  struct proc *cur = c->proc;
+
+  if (cur == 0 || cur == p)
+    return 0;
+  if (p->rtprio || cur->rtprio)
+  {
+    // a real-time process preempts anything of lower priority
+    if (p->rtprio <= cur->rtprio || rt_throttled(rq))
+      return 0;
+  }
+  else if (!rq->policy->preempts(rq, p, cur))
+    return 0;
+  c->need_resched = 1;
+  return 1;
+}
+
+// Return whether the running process should yield because a process
+// woken up for this CPU has a much lower pass (see wakeup_preempts).
+int resched_pending(void)
+{
+  int pending;
+
+  pushcli();
+  pending = mycpu()->need_resched;
+  popcli();
+  return pending;
+}
+
+// Return whether p may run on the given CPU.
+static int cpu_allowed(struct proc *p, int cpu)
+{
+  return (p->affinity >> cpu) & 1;
+}
+
+// Return the CPU whose run queue p should join: the one it last ran
+// on, whose cache is likely still warm, unless its affinity mask has
+// changed to exclude it.
+static int pick_cpu(struct proc *p)
+{
+  int cpu;
+
+  if (cpu_allowed(p, p->cpu))
+    return p->cpu;
+  for (cpu = 0; cpu < ncpu; cpu++)
+    if (cpu_allowed(p, cpu))
+      return cpu;
+  return p->cpu;
+}
+
+// Mark a SLEEPING or EMBRYO process RUNNABLE and queue it on the
+// run queue of the CPU it last ran on. Taking that lock also waits
+// for that CPU to finish switching away from p if it is still doing
+// so. The caller must hold ptable.lock.
+static void make_runnable(struct proc *p)
+{
+  struct runqueue *rq;
+  int preempt;
+
+  // Wait for p's old CPU before it may be queued elsewhere.
+  rq = &runqueues[p->cpu];
+  if (!cpu_allowed(p, p->cpu))
+  {
+    acquire(&rq->lock);
+    release(&rq->lock);
+    p->cpu = pick_cpu(p);
+    rq = &runqueues[p->cpu];
+  }
+
+  acquire(&rq->lock);
+  p->state = RUNNABLE;
+  p->runnable_since = rdtsc();
+
+  /* stride scheduling */
+  enqueue(rq, p);
+  preempt = wakeup_preempts(rq, p);
+  release(&rq->lock);
+
+  // release() is a full barrier between the insert and reading
+  // cpus[].idle; idle() orders the same two the other way round.
+  kick_cpu(rq - runqueues, preempt, p->affinity);
+}
+
+// p, a member of a gang, was picked to run on this CPU: unless the
+// gang is already running, start its time slice and interrupt every
+// other CPU that has a member queued so that it runs that member,
+// unless it is running one already.
+// Must be called with interrupts disabled.
+static void gang_activate(struct proc *p)
+{
+  struct stride_group *g = p->group;
+  struct proc *cur;
+  int cpu;
+
+  if (g == 0 || !g->gang || gang_active(g))
+    return;
+  g->gang_until = ticks + p->quantum;
+  if ((int)(g->gang_until - gang_until) > 0)
+    gang_until = g->gang_until;
+  // The queued lists and cpus[].proc are read without the other
+  // run queue locks: a CPU kicked for nothing just picks its next
+  // process again.
+  for (cpu = 0; cpu < ncpu; cpu++)
+  {
+    if (cpu == cpuid() || list_empty(&g->queued[cpu]))
+      continue;
+    cur = cpus[cpu].proc;
+    if (cur != 0 && cur->group == g)
+      continue;
+    cpus[cpu].need_resched = 1;
+    kick_cpu(cpu, 1, ~0);
+  }
+}
+
+// Halt this CPU, whose run queue is rq, until an interrupt arrives,
+// unless rq has work. The caller has just failed to steal from the
+// other run queues, so work queued there is either not allowed here
+// or arrived since; it will be kicked to its own CPU. Counting it
+// here would keep this CPU spinning on steal() for work pinned
+// elsewhere. c->idle is set before rq is checked, and
+// make_runnable() checks it after queueing, so a wakeup that races
+// with going idle always ends in a reschedule IPI. CPUs other than
+// the first, which keeps the ticks counter, also mask their timer
+// so they are not woken 100 times a second for nothing.
+// Before that, the idle time goes into zeroing pages for
+// kalloc_zeroed(), one at a time so that new work is not kept waiting.
+static void idle(struct cpu *c, struct runqueue *rq)
+{
+  if (kzero_idle())
+    return;
+
+  cli();
+  c->idle = 1;
+  __sync_synchronize();
+  if (rq->size + rq->nrt == 0)
+  {
+    if (c != &cpus[0])
+      lapictimer(0);
+    sti_hlt();
+    if (c != &cpus[0])
+      lapictimer(1);
+  }
+  c->idle = 0;
+  sti();
+}
+
+/* Queue p, which is RUNNABLE but on no run queue, on rq. Nobody
+   else touches such a process, so no lock needs to be held, and
+   interrupts may be on: they are turned off around kick_cpu(),
+   which needs to know which CPU it is on.
+   p joins rq's client set with the remain it left its old one with,
+   so it neither gains nor loses credit by migrating.
+*/
+static void migrate(struct runqueue *rq, struct proc *p)
+{
+  int preempt;
+
+  pushcli();
+  acquire(&rq->lock);
+  p->cpu = rq - runqueues;
+  p->nmigrations++;
+  enqueue(rq, p);
+  preempt = wakeup_preempts(rq, p);
+  release(&rq->lock);
+  kick_cpu(rq - runqueues, preempt, p->affinity);
+  popcli();
+}
+
+/* Take the first real-time process, or else the lowest-pass process,
+   that may run on rq's CPU off victim. Returns NULL if there is none.
+*/
+static struct proc *steal_from(struct runqueue *rq, struct runqueue *victim)
+{
+  struct proc *p = NULL;
+  int cpu = rq - runqueues;
+  int i, best = -1;
+
+  acquire(&victim->lock);
+  for (i = RT_NPRIO - 1; i >= 0; i--)
+  {
+    list_for_each_entry(p, &victim->rt[i], rt_elem)
+    {
+      if (cpu_allowed(p, cpu))
+      {
+        rt_dequeue(victim, p);
+        release(&victim->lock);
+        return p;
+      }
+    }
+  }
+  p = NULL;
+  for (i = 0; i < victim->size; i++)
+  {
+    if (!cpu_allowed(victim->heap[i], cpu))
+      continue;
+    if (best < 0 ||
+        victim->heap[i]->stride_info.pass_value < victim->heap[best]->stride_info.pass_value)
+      best = i;
+  }
+  if (best >= 0)
+  {
+    p = victim->heap[best];
+    victim->policy->remove(victim, p);
+    gang_count(victim, p, -1);
+    stride_leave(victim, p);
+  }
+  release(&victim->lock);
+  return p;
+}
+
+/* Move the lowest-pass process that may run here from the busiest
+   other run queue to rq, or from any other if the busiest has none.
+   Returns 1 if a process was moved, 0 otherwise.
+   This function is called from scheduler() when rq is empty.
+*/
+static int steal(struct runqueue *rq)
+{
+  struct runqueue *r, *victim = NULL;
+  struct proc *p = NULL;
+  int busiest = 0;
+
+  // Queue sizes are read without locks; they are only a hint
+  // and are checked again once the victim is locked.
+  for (r = runqueues; r < &runqueues[ncpu]; r++)
+  {
+    if (r != rq && r->size + r->nrt > busiest)
+    {
+      busiest = r->size + r->nrt;
+      victim = r;
+    }
+  }
+  if (victim == NULL)
+    return 0;
+
+  p = steal_from(rq, victim);
+  for (r = runqueues; p == NULL && r < &runqueues[ncpu]; r++)
+    if (r != rq && r != victim && r->size + r->nrt > 0)
+      p = steal_from(rq, r);
+  if (p == NULL)
+    return 0;
+
+  acquire(&rq->lock);
+  p->cpu = rq - runqueues;
+  p->nmigrations++;
+  enqueue(rq, p);
+  rq->nsteals++;
+  release(&rq->lock);
+  return 1;
+}
+
+/* Pull one process over from the CPU with the most global tickets if
+   this CPU has fewer by more than 1/BALANCE_IMBALANCE of that, so that
+   small differences do not cause any migration. Only a process whose
+   funding is at most half the difference is taken: the move narrows
+   the gap without reversing it, so the other CPU has no reason to
+   pull it back. Processes that ran in the last BALANCE_HOT_TICKS ticks
+   are left alone while their cache is still warm. Of the rest, the
+   one with the most funding moves.
+   Called from trap() on every timer interrupt; it does something
+   every BALANCE_INTERVAL ticks.
+*/
+void loadbalance(void)
 {
-  struct proc *targetProcess = NULL;
-  struct proc *minProcess = NULL;
-  struct list_head *item = NULL;
+  struct runqueue *rq, *r, *victim = NULL;
+  struct proc *p, *best = NULL;
+  int cpu, i, diff;
 
-  // iterate all list
-  list_for_each(item, head)
+  pushcli();
+  cpu = cpuid();
+  rq = &runqueues[cpu];
+  if ((int)(ticks - rq->next_balance) < 0)
+  {
+    popcli();
+    return;
+  }
+  rq->next_balance = ticks + BALANCE_INTERVAL;
+
+  // Tickets are read without locks; they are only a hint
+  // and are checked again once the victim is locked.
+  for (r = runqueues; r < &runqueues[ncpu]; r++)
+    if (r != rq && (victim == NULL || r->tickets > victim->tickets))
+      victim = r;
+  if (victim == NULL || victim->tickets - rq->tickets <= victim->tickets / BALANCE_IMBALANCE)
   {
-    // get process
-    targetProcess = list_entry(item, struct proc, queue_elem);
+    popcli();
+    return;
+  }
 
-    // when not runnable skip
-    if (targetProcess->state != RUNNABLE)
+  acquire(&victim->lock);
+  diff = victim->tickets - rq->tickets;
+  for (i = 0; i < victim->size; i++)
+  {
+    p = victim->heap[i];
+    if (!cpu_allowed(p, cpu) || p->stride_info.funding > diff / 2 ||
+        ticks - p->last_ran < BALANCE_HOT_TICKS)
       continue;
-    
-    // find min
-    if(minProcess == NULL) // just store at first
-    {
-      minProcess = targetProcess;
-    }
-    else
-    { // if minProcess is larger store smaller one
-      if(minProcess->stride_info.pass_value > targetProcess->stride_info.pass_value)
-      {
-        minProcess = targetProcess;
-      }
-    }
+    if (best == NULL || p->stride_info.funding > best->stride_info.funding)
+      best = p;
   }
-  
-  // if no process found
-  if(minProcess == NULL)
+  if (best != NULL)
   {
-    return NULL;
+    victim->policy->remove(victim, best);
+    gang_count(victim, best, -1);
+    stride_leave(victim, best);
   }
-  else
+  release(&victim->lock);
+
+  if (best != NULL)
   {
-    // if has process then remove and return minProcess
-    // list_del(minProcess)// reinitialize??
-    list_del_init(&minProcess->queue_elem);
-    return minProcess;
+    acquire(&rq->lock);
+    best->cpu = cpu;
+    best->nmigrations++;
+    enqueue(rq, best);
+    rq->nbalanced++;
+    release(&rq->lock);
   }
+  popcli();
 }
 
-/* Update the process' pass value after a run by the scheduler.
-   This function is called from scheduler().
+// Recompute the funding of the current process after it changed
+// its tickets or its group. Must be called with ptable.lock held.
+static void refresh_my_funding(void)
+{
+  struct proc *p = myproc();
+  struct runqueue *rq;
+
+  rq = lockmyrq();
+  p->stride_info.group_gen = ptable.group_gen;
+  set_funding(rq, p, compute_funding(p), !p->rtprio);
+  release(&rq->lock);
+}
+
+/* Assign Tickets to current (cpu running) process by system call.
+   The tickets are in the currency of the process' group. The CPU's
+   global tickets follow the change, and the part of the current
+   stride still left to run is rescaled to the new stride.
+   Returns -1 if tickets is outside [1, STRIDE_MAX_TICKETS].
+*/
+int assign_tickets(int tickets)
+{
+  struct proc *p = myproc();
+
+  if (tickets < 1 || tickets > STRIDE_MAX_TICKETS)
+    return -1;
+
+  acquire(&ptable.lock);
+  if (p->group && p->stride_info.active)
+  {
+    acquire(&ptable.glock);
+    group_active(p->group, tickets - p->stride_info.tickets, 0);
+    release(&ptable.glock);
+    group_changed();
+  }
+  // assign new ticket to running process (mycpu()->proc)
+  p->stride_info.tickets = tickets;
+  traceevent(TRACE_TICKETS, p->pid, tickets);
+  refresh_my_funding();
+  release(&ptable.lock);
+  return 0;
+}
+
+/* Set how many timer ticks the current process runs before it is
+   preempted. Its pass is still charged by the CPU time it used.
+   Returns -1 if quantum is outside [1, MAXQUANTUM].
 */
-void update_pass_value(struct proc *proc)
+int assign_quantum(int quantum)
 {
-  proc->stride_info.pass_value += proc->stride_info.stride;
+  if (quantum < 1 || quantum > MAXQUANTUM)
+    return -1;
+  myproc()->quantum = quantum;
+  return 0;
 }
 
-/* Update the global variable, ptable.min_pass_value, after a process' run by the scheduler.
-   The function assigns the lowest pass value among RUNNABLE processes to ptable.min_pass_value.
-   This function is called from scheduler().
+/* Move the current process into the real-time FIFO class with the
+   given priority, 1 (lowest) to RT_NPRIO, or back into the stride
+   class if prio is 0. Real-time processes are not stride clients,
+   so the process leaves or rejoins its CPU's client set here.
+   Returns -1 if prio is out of range.
 */
-void update_min_pass_value()
+int assign_rtprio(int prio)
 {
-  struct proc *targetProcess = NULL;
-  int isFirst = 1; // to determine if finding minimun value is just started
-  long long minPassValue = 0; // minimun pass value is at least 0
-  long long itemPassValue = 0;
-  struct list_head *item = NULL;
-  struct list_head *head = &ptable.queue_head;
+  struct proc *p = myproc();
+  struct runqueue *rq;
+
+  if (prio < 0 || prio > RT_NPRIO)
+    return -1;
+
+  rq = lockmyrq();
+  if (p->rtprio == 0 && prio > 0)
+    stride_leave(rq, p);
+  else if (p->rtprio > 0 && prio == 0)
+    stride_join(rq, p);
+  p->rtprio = prio;
+  release(&rq->lock);
+  return 0;
+}
+
+/* Switch every CPU to scheduling policy id (SCHED_STRIDE or
+   SCHED_LOTTERY). The processes queued on each run queue are moved
+   over to the new policy's order. Returns the previous policy, or -1
+   if id is not a policy.
+*/
+int set_sched_policy(int id)
+{
+  static struct proc *moved[NPROC]; // protected by ptable.lock
+  struct sched_policy *new;
+  struct runqueue *rq;
+  struct proc *p;
+  int i, n, old;
+
+  if (id < 0 || id >= NELEM(policies))
+    return -1;
+  new = policies[id];
 
-  // iterate all list
-  list_for_each(item, head)
+  // ptable.lock serializes switches
+  acquire(&ptable.lock);
+  old = runqueues[0].policy == &stride_policy ? SCHED_STRIDE : SCHED_LOTTERY;
+  for (rq = runqueues; rq < &runqueues[NCPU]; rq++)
   {
-    targetProcess = list_entry(item, struct proc, queue_elem);
+    acquire(&rq->lock);
+    for (n = 0; (p = rq->policy->pick(rq)) != NULL; n++)
+      moved[n] = p;
+    rq->policy = new;
+    for (i = 0; i < n; i++)
+      new->insert(rq, moved[i]);
+    release(&rq->lock);
+  }
+  release(&ptable.lock);
+  return old;
+}
+
+// Return the group with the given gid, or 0.
+// The ptable lock must be held.
+static struct stride_group *findgroup(int gid)
+{
+  struct stride_group *g;
+
+  if (gid < 1 || gid > NSTRIDEGROUP)
+    return 0;
+  g = &ptable.groups[gid - 1];
+  if (g->gid != gid)
+    return 0;
+  return g;
+}
+
+/* Create a stride group funded with tickets of the parent group's currency.
+   parent is 0 to create the group directly under the root.
+   Returns the new group's gid, or -1.
+*/
+int stride_group_create(int parent, int tickets)
+{
+  struct stride_group *g, *pg = 0;
+
+  if (tickets < 1 || tickets > STRIDE_MAX_TICKETS)
+    return -1;
 
-    // when not runnable skip
-    if (targetProcess->state != RUNNABLE)
+  acquire(&ptable.lock);
+  if (parent != 0 && (pg = findgroup(parent)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  for (g = ptable.groups; g < &ptable.groups[NSTRIDEGROUP]; g++)
+  {
+    if (g->gid != 0)
       continue;
-    
-    itemPassValue = targetProcess->stride_info.pass_value;
-    // find minimun pass value
-    if(isFirst)
-    { // when first just store anything 
-      minPassValue = itemPassValue;
-      isFirst = 0;
-    }
-    else
-    { // if smaller one is found, store that as minPassValue
-      if(minPassValue > itemPassValue)
-      {
-        minPassValue = itemPassValue;
-      }
-    }
+    g->gid = g - ptable.groups + 1;
+    g->tickets = tickets;
+    g->active_tickets = 0;
+    g->nactive = 0;
+    g->nmembers = 0;
+    g->parent = pg;
+    g->gang = 0;
+    g->gang_until = 0;
+    // an empty group is inactive, so its parent's funding is unchanged
+    if (pg)
+      pg->nmembers++;
+    release(&ptable.lock);
+    return g->gid;
   }
+  release(&ptable.lock);
+  return -1;
+}
+
+/* Change the funding of a stride group. Every member's share follows.
+   Returns -1 if there is no such group or tickets is out of range.
+*/
+int stride_group_tickets(int gid, int tickets)
+{
+  struct stride_group *g;
+
+  if (tickets < 1 || tickets > STRIDE_MAX_TICKETS)
+    return -1;
 
-  // update min value to global variable
-  ptable.min_pass_value = minPassValue;
+  acquire(&ptable.lock);
+  if ((g = findgroup(gid)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  acquire(&ptable.glock);
+  if (g->parent && g->nactive > 0)
+    group_active(g->parent, tickets - g->tickets, 0);
+  g->tickets = tickets;
+  release(&ptable.glock);
+  group_changed();
+  refresh_my_funding();
+  release(&ptable.lock);
+  return 0;
 }
 
-/* Insert the current process into the queue after a run by the scheduler.
-   This function is called from scheduler().
+/* Move the current process into group gid, or back under the root
+   if gid is 0. Children forked afterwards start in the same group.
+   Returns -1 if there is no such group.
 */
-void insert(struct list_head *head, struct proc *current)
+int stride_group_join(int gid)
 {
-  INIT_LIST_HEAD(&current->queue_elem);
-  list_add_tail(&current->queue_elem, head);
+  struct proc *p = myproc();
+  struct stride_group *g = 0;
+
+  acquire(&ptable.lock);
+  if (gid != 0 && (g = findgroup(gid)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  acquire(&ptable.glock);
+  if (p->group)
+  {
+    if (p->stride_info.active)
+      group_active(p->group, -p->stride_info.tickets, -1);
+    p->group->nmembers--;
+  }
+  p->group = g;
+  if (g)
+  {
+    if (p->stride_info.active)
+      group_active(g, p->stride_info.tickets, 1);
+    g->nmembers++;
+  }
+  release(&ptable.glock);
+  group_changed();
+  refresh_my_funding();
+  release(&ptable.lock);
+  return 0;
 }
 
-/* Assign the lowest pass value in the system to a new process or wake-up process.
-   This function is called from fork() and wakeup1().
+/* Turn co-scheduling of the member processes of group gid on or off.
+   Returns -1 if there is no such group.
 */
-void assign_min_pass_value(struct proc *proc)
+int stride_group_gang(int gid, int on)
 {
-  proc->stride_info.pass_value = ptable.min_pass_value; // assign min_pass_value to given proc
+  struct stride_group *g;
+
+  acquire(&ptable.lock);
+  if ((g = findgroup(gid)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  g->gang = on != 0;
+  release(&ptable.lock);
+  return 0;
 }
 
-/* Assign Tickets to current (cpu running) process by system call
+/* Free a stride group that has no member processes or child groups.
+   Returns -1 if there is no such group or it is still in use.
 */
-void assign_tickets(int tickets)
+int stride_group_destroy(int gid)
 {
-  // assign new ticket to running process (mycpu()->proc)
-  myproc()->stride_info.tickets = tickets;
-  // stride = a large number / number of ticket
-  myproc()->stride_info.stride = (STRIDE_LARGE_NUMBER)/(tickets);
+  struct stride_group *g;
+
+  acquire(&ptable.lock);
+  if ((g = findgroup(gid)) == 0 || g->nmembers > 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  // without members g is inactive and not in its parent's sum
+  if (g->parent)
+    g->parent->nmembers--;
+  g->gid = 0;
+  g->parent = 0;
+  release(&ptable.lock);
+  return 0;
 }
 
 /* Initialize the process's stride_info member variables.
@@ -163,16 +1397,37 @@ void initialize_stride_info(struct proc *proc)
 {
   proc->stride_info.tickets = 100;
   proc->stride_info.pass_value = 0; // should start from zero
+  proc->stride_info.funding = proc->stride_info.tickets;
+  proc->stride_info.group_gen = 0; // ptable.group_gen starts at 1
   // stride = a large number / number of ticket
-  proc->stride_info.stride = (STRIDE_LARGE_NUMBER) / (proc->stride_info.tickets);
+  proc->stride_info.stride = STRIDE_ONE / proc->stride_info.tickets;
+  // a new client joins one stride after the global pass
+  proc->stride_info.remain = proc->stride_info.stride;
 }
 
 void pinit(void)
 {
+  struct runqueue *rq;
+  int i, j;
+
   initlock(&ptable.lock, "ptable");
+  initlock(&ptable.glock, "groups");
+  for (i = 0; i < NSTRIDEGROUP; i++)
+    for (j = 0; j < NCPU; j++)
+      INIT_LIST_HEAD(&ptable.groups[i].queued[j]);
+  kmem_cache_init(&proccache, "proc", sizeof(struct proc));
+  for (rq = runqueues; rq < &runqueues[NCPU]; rq++)
+  {
+    initlock(&rq->lock, "runqueue");
+    rq->policy = policies[SCHED_POLICY];
+    rq->seed = (uint)rdtsc() * 2654435761U + (rq - runqueues) + 1;
+    for (i = 0; i < RT_NPRIO; i++)
+      INIT_LIST_HEAD(&rq->rt[i]);
+  }
 
   /* stride scheduling */
   ptable.large_number = STRIDE_LARGE_NUMBER;
+  ptable.group_gen = 1;
 }
 
 // Must be called with interrupts disabled
@@ -214,6 +1469,24 @@ struct proc *myproc(void)
   return p;
 }
 
+// Unlink p from the process table and free it.
+// Caller must hold ptable.lock and have released
+// p's kernel stack and page table.
+static void freeproc(struct proc *p)
+{
+  hlist_del_init(&p->pid_elem);
+  list_del_init(&p->sibling);
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+
+  list_del_init(&p->queue_elem);
+  ptable.nproc--;
+  kmem_cache_free(&proccache, p);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -226,33 +1499,47 @@ static struct proc *allocproc(void)
 
   acquire(&ptable.lock);
 
-  p = (struct proc *)k_malloc(sizeof(struct proc));
-
-  if (p != NULL)
+  // The run queue has room for NPROC processes.
+  if (ptable.nproc >= NPROC)
   {
-    memset(p, 0, sizeof(struct proc));
+    release(&ptable.lock);
+    return 0;
   }
-  else
+
+  if ((p = kmem_cache_alloc(&proccache)) == 0)
   {
     release(&ptable.lock);
     return 0;
   }
+  memset(p, 0, sizeof(struct proc));
 
   INIT_LIST_HEAD(&p->queue_elem);
   list_add_tail(&p->queue_elem, &ptable.queue_head);
+  INIT_HLIST_NODE(&p->sleep_elem);
+  INIT_LIST_HEAD(&p->rt_elem);
+  INIT_LIST_HEAD(&p->gang_elem);
+  INIT_LIST_HEAD(&p->children);
+  INIT_LIST_HEAD(&p->sibling);
+  ptable.nproc++;
 
   /* stride scheduling */
   initialize_stride_info(p);
+  p->rq_index = -1;
+  p->quantum = 1;
+  p->affinity = ~0;
 
   p->state = EMBRYO;
   p->pid = nextpid++;
+  hlist_add_head(&p->pid_elem, &ptable.pidhash[p->pid & (NPIDHASH - 1)]);
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if ((p->kstack = kalloc()) == 0)
   {
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -308,7 +1595,8 @@ void userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  p->cpu = cpuid();
+  make_runnable(p);
 
   release(&ptable.lock);
 }
@@ -356,11 +1644,16 @@ int fork(void)
   {
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
+  np->cpu = curproc->cpu;
+  np->quantum = curproc->quantum;
+  np->affinity = curproc->affinity;
+  np->rtprio = curproc->rtprio;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -377,10 +1670,19 @@ int fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
-
-  /* stride scheduling */
-  assign_min_pass_value(np);
+  np->parent = curproc;
+  list_add_tail(&np->sibling, &curproc->children);
+  np->group = curproc->group;
+  if (np->group)
+  {
+    // np becomes active when stride_join() first queues it
+    np->group->nmembers++;
+    // spread the members of a gang over the CPUs
+    if (np->group->gang)
+      np->cpu = (curproc->cpu + np->group->nmembers - 1) % ncpu;
+  }
+  make_runnable(np);
+  traceevent(TRACE_FORK, curproc->pid, pid);
 
   release(&ptable.lock);
 
@@ -394,7 +1696,7 @@ void exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
+  int fd, zombies;
 
   if (curproc == initproc)
     panic("init exiting");
@@ -415,28 +1717,37 @@ void exit(void)
   curproc->cwd = 0;
 
   acquire(&ptable.lock);
+  traceevent(TRACE_EXIT, curproc->pid, 0);
 
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
+  zombies = 0;
+  list_for_each_entry(p, &curproc->children, sibling)
+  {
+    p->parent = initproc;
+    if (p->state == ZOMBIE)
+      zombies = 1;
+  }
+  list_splice_tail_init(&curproc->children, &initproc->children);
+  if (zombies)
+    wakeup1(initproc);
 
-  struct list_head *head = &ptable.queue_head;
-  struct list_head *iter;
-
-  list_for_each(iter, head)
+  // Give our tickets back to our group.
+  if (curproc->group)
   {
-    p = list_entry(iter, struct proc, queue_elem);
-    if (p->parent == curproc)
-    {
-      p->parent = initproc;
-      if (p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+    proc_active(curproc, -1);
+    curproc->group->nmembers--;
+    curproc->group = 0;
   }
 
   // Jump into the scheduler, never to return.
+  // Take our run queue lock before anyone can see ZOMBIE, so that
+  // wait() cannot free our stack until we have switched away.
+  lockmyrq();
   curproc->state = ZOMBIE;
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
@@ -448,36 +1759,26 @@ int wait(void)
   struct proc *p;
   int havekids, pid;
   struct proc *curproc = myproc();
-  struct list_head *head = &ptable.queue_head;
-  struct list_head *iter, *n;
 
   acquire(&ptable.lock);
   for (;;)
   {
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    list_for_each_safe(iter, n, head)
+    list_for_each_entry(p, &curproc->children, sibling)
     {
-      p = list_entry(iter, struct proc, queue_elem);
-
-      if (p->parent != curproc)
-        continue;
       havekids = 1;
       if (p->state == ZOMBIE)
       {
-        // Found one.
+        // Found one. Wait for its CPU to finish
+        // switching away from it (see exit).
+        acquire(&runqueues[p->cpu].lock);
+        release(&runqueues[p->cpu].lock);
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
-
-        list_del_init(&p->queue_elem);
-        k_free(p);
+        freeproc(p);
 
         release(&ptable.lock);
 
@@ -509,52 +1810,117 @@ void scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  unsigned long long start, end;
+  uint charge;
   c->proc = 0;
 
-  struct list_head *head = &ptable.queue_head;
+  struct runqueue *rq = myrq();
 
   for (;;)
   {
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
+    // Take the next process off this CPU's run queue.
+    acquire(&rq->lock);
 
-    // 1. pick client with min pass
-    p = remove_min(head);
+    // 1. pick a real-time process, or the client with min pass
+    p = pick_next(rq);
 
-    // if runnable process is found, run it
-    if(p != NULL)
+    // nothing to run here: take work from a busier CPU,
+    // or halt until there is some
+    if(p == NULL)
     {
-      // 2. run p for quantum
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-      // 3. update pass using stride
-      update_pass_value(p);
-      // 4. return current process to queue       
-      insert(head,p);
-      // after process run, update ptable min value
-      update_min_pass_value();
+      release(&rq->lock);
+      if (!steal(rq))
+        idle(c, rq);
+      continue;
     }
 
-    release(&ptable.lock);
+    // its affinity mask no longer allows this CPU: hand it over
+    if (!cpu_allowed(p, rq - runqueues))
+    {
+      if (!p->rtprio)
+        stride_leave(rq, p);
+      release(&rq->lock);
+      migrate(&runqueues[pick_cpu(p)], p);
+      continue;
+    }
+
+    gang_activate(p);
+
+    // 2. run p for quantum
+    // Switch to chosen process.  It is the process's job
+    // to release the run queue lock and then reacquire it
+    // before jumping back to us.
+    traceevent(TRACE_PICK, p->pid, rq->size);
+    c->proc = p;
+    c->need_resched = 0;
+    switchuvm(p);
+    p->state = RUNNING;
+    p->slice = p->quantum;
+
+    start = rdtsc();
+    p->wait_cycles += start - p->runnable_since;
+    p->npicked++;
+    traceevent(TRACE_SWITCHIN, p->pid, p->quantum);
+    swtch(&(c->scheduler), p->context);
+    end = rdtsc();
+    traceevent(TRACE_SWITCHOUT, p->pid, p->state);
+    p->run_cycles += end - start;
+    charge = quantum_charge(end - start);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    p->last_ran = ticks;
+    // 3. update pass using stride, and global pass using global stride;
+    //    real-time processes count against the throttle instead
+    if (p->rtprio)
+    {
+      rt_throttled(rq);
+      rq->rt_used += charge;
+    }
+    else
+    {
+      refresh_funding(rq, p, 1);
+      rq->policy->charge(rq, p, charge);
+    }
+    // 4. return current process to queue if it yield()ed;
+    //    sleeping and exiting processes leave the client set
+    if (p->state == RUNNABLE)
+    {
+      if (p->yielded)
+        p->nvcsw++;
+      else
+        p->nivcsw++;
+      p->runnable_since = end;
+      if (p->rtprio)
+      {
+        rt_enqueue(rq, p, !p->yielded);
+      }
+      else
+      {
+        rq->policy->insert(rq, p);
+        gang_count(rq, p, 1);
+      }
+      p->yielded = 0;
+    }
+    else
+    {
+      p->nvcsw++;
+      if (!p->rtprio)
+        stride_leave(rq, p);
+    }
+    renormalize_pass_values(rq);
+
+    release(&rq->lock);
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
+// Enter scheduler.  Must hold only this CPU's run queue
+// lock and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->ncli, but that would
@@ -565,8 +1931,8 @@ void sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if (!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if (!holding(&myrq()->lock))
+    panic("sched runqueue lock");
   if (mycpu()->ncli != 1)
     panic("sched locks");
   if (p->state == RUNNING)
@@ -581,10 +1947,21 @@ void sched(void)
 // Give up the CPU for one scheduling round.
 void yield(void)
 {
-  acquire(&ptable.lock); //DOC: yieldlock
+  lockmyrq(); //DOC: yieldlock
   myproc()->state = RUNNABLE;
   sched();
-  release(&ptable.lock);
+  // We may have been moved to another CPU meanwhile.
+  release(&myrq()->lock);
+}
+
+// Give up the CPU on behalf of the process itself, which is
+// counted as a voluntary switch. Like any other run, it is
+// charged only for the CPU time it used (see quantum_charge),
+// so a process that yields early keeps most of its pass.
+void sched_yield(void)
+{
+  myproc()->yielded = 1;
+  yield();
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -592,8 +1969,8 @@ void yield(void)
 void forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding the run queue lock from scheduler.
+  release(&myrq()->lock);
 
   if (first)
   {
@@ -631,13 +2008,22 @@ void sleep(void *chan, struct spinlock *lk)
     acquire(&ptable.lock); //DOC: sleeplock1
     release(lk);
   }
-  // Go to sleep.
+  // Go to sleep. Hand over from ptable.lock to the
+  // run queue lock that sched() needs; a concurrent
+  // wakeup1() will wait on the run queue lock until
+  // this CPU has switched away from us.
   p->chan = chan;
+  hlist_add_head(&p->sleep_elem, sleepq_bucket(chan));
+  traceevent(TRACE_SLEEP, p->pid, (uint)chan);
+  lockmyrq();
   p->state = SLEEPING;
+  release(&ptable.lock);
 
   sched();
 
   // Tidy up.
+  release(&myrq()->lock);
+  acquire(&ptable.lock);
   p->chan = 0;
 
   // Reacquire original lock.
@@ -654,18 +2040,16 @@ void sleep(void *chan, struct spinlock *lk)
 static void wakeup1(void *chan)
 {
   struct proc *p;
-  struct list_head *head = &ptable.queue_head;
-  struct list_head *iter;
+  struct hlist_node *n;
 
-  list_for_each(iter, head)
+  // Only processes hashed to chan's bucket can be sleeping on it.
+  hlist_for_each_entry_safe(p, n, sleepq_bucket(chan), sleep_elem)
   {
-    p = list_entry(iter, struct proc, queue_elem);
     if (p->state == SLEEPING && p->chan == chan)
     {
-      p->state = RUNNABLE;
-
-      /* stride scheduling */
-      assign_min_pass_value(p);
+      hlist_del_init(&p->sleep_elem);
+      make_runnable(p);
+      traceevent(TRACE_WAKEUP, p->pid, p->cpu);
     }
   }
 }
@@ -684,26 +2068,136 @@ void wakeup(void *chan)
 int kill(int pid)
 {
   struct proc *p;
-  struct list_head *head = &ptable.queue_head;
+
+  acquire(&ptable.lock);
+  p = findproc(pid);
+  if (p != 0)
+  {
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if (p->state == SLEEPING)
+    {
+      hlist_del_init(&p->sleep_elem);
+      make_runnable(p);
+      traceevent(TRACE_WAKEUP, p->pid, p->cpu);
+    }
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Restrict the process with the given pid to the CPUs whose bits are
+// set in mask. A process that is queued or asleep moves to an allowed
+// CPU when it is next picked or woken; the calling process moves at
+// once. Returns -1 if there is no such process or mask allows no CPU.
+int setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+  int move;
+
+  if (ncpu < 32)
+    mask &= (1U << ncpu) - 1;
+  if (mask == 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  p->affinity = mask;
+  move = p == myproc() && !cpu_allowed(p, p->cpu);
+  release(&ptable.lock);
+
+  // scheduler() migrates us when it next picks us
+  if (move)
+    yield();
+  return 0;
+}
+
+// Copy the scheduling statistics of the process with the given pid
+// to *st. The counters are updated by the scheduler of the CPU that
+// owns the process, under its run queue lock, so take that lock too
+// to read them consistently. Returns -1 if there is no such process.
+int getschedstat(int pid, struct schedstat *st)
+{
+  struct proc *p;
+  struct runqueue *rq;
+
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) == 0)
+  {
+    release(&ptable.lock);
+    return -1;
+  }
+  rq = &runqueues[p->cpu];
+  acquire(&rq->lock);
+  st->pid = p->pid;
+  st->tickets = p->stride_info.tickets;
+  st->funding = p->stride_info.funding;
+  st->quantum = p->quantum;
+  st->npicked = p->npicked;
+  st->nmigrations = p->nmigrations;
+  st->nvcsw = p->nvcsw;
+  st->nivcsw = p->nivcsw;
+  st->tsc_per_tick = tsc_per_tick;
+  st->run_cycles = p->run_cycles;
+  st->wait_cycles = p->wait_cycles;
+  release(&rq->lock);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Copy the pids of up to n processes to the user address addr,
+// in the order they were created. Returns how many were copied.
+// copyout() does not sleep, so it can run under the ptable lock,
+// and the list cannot change underneath it.
+int getpids(uint addr, int n)
+{
   struct list_head *iter;
+  struct proc *p;
+  int i = 0;
 
   acquire(&ptable.lock);
-  list_for_each(iter, head)
+  list_for_each(iter, &ptable.queue_head)
   {
     p = list_entry(iter, struct proc, queue_elem);
-
-    if (p->pid == pid)
+    if (i >= n)
+      break;
+    if (p->state == UNUSED)
+      continue;
+    if (copyout(myproc()->pgdir, addr + i * sizeof(int), &p->pid, sizeof(int)) < 0)
     {
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if (p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
+      i = -1;
+      break;
     }
+    i++;
   }
   release(&ptable.lock);
-  return -1;
+  return i;
+}
+
+// Copy the load and migration counters of a CPU's run queue to *st.
+// Returns -1 if there is no such CPU.
+int getrqstat(int cpu, struct rqstat *st)
+{
+  struct runqueue *rq;
+
+  if (cpu < 0 || cpu >= ncpu)
+    return -1;
+  rq = &runqueues[cpu];
+  acquire(&rq->lock);
+  st->cpu = cpu;
+  st->nqueued = rq->size;
+  st->nrt = rq->nrt;
+  st->tickets = rq->tickets;
+  st->nsteals = rq->nsteals;
+  st->nbalanced = rq->nbalanced;
+  release(&rq->lock);
+  return 0;
 }
 
 //PAGEBREAK: 36
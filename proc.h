@@ -9,6 +9,8 @@ struct cpu
   int ncli;                  // Depth of pushcli nesting.
   int intena;                // Were interrupts enabled before pushcli?
   struct proc *proc;         // The process running on this cpu or null
+  volatile uint idle;        // Is the CPU halted in the scheduler's idle loop?
+  volatile uint need_resched; // Should the running process yield at the next trap?
 };
 
 extern struct cpu cpus[NCPU];
@@ -16,21 +18,84 @@ extern int ncpu;
 
 /* stride scheduling */
 #include "list.h"
-#define STRIDE_LARGE_NUMBER 10000
 
-struct proc *remove_min(struct list_head *head);
-void update_pass_value(struct proc *proc);
-void update_min_pass_value();
-void insert(struct list_head *head, struct proc *current);
-void assign_min_pass_value(struct proc *proc);
-void assign_tickets(int tickets);
+// Strides are fixed-point numbers with STRIDE_FRAC_BITS fractional
+// bits: stride = STRIDE_ONE / tickets. Both knobs can be overridden
+// from CFLAGS, but their sum must stay below 32 so that the division
+// is done in 32-bit arithmetic (there is no 64-bit divide in the kernel).
+#ifndef STRIDE_SHIFT
+#define STRIDE_SHIFT 20
+#endif
+#ifndef STRIDE_FRAC_BITS
+#define STRIDE_FRAC_BITS 11
+#endif
+#if STRIDE_SHIFT + STRIDE_FRAC_BITS > 31
+#error "STRIDE_SHIFT + STRIDE_FRAC_BITS must be at most 31"
+#endif
+#define STRIDE_LARGE_NUMBER (1 << STRIDE_SHIFT)
+#define STRIDE_ONE          ((uint)STRIDE_LARGE_NUMBER << STRIDE_FRAC_BITS)
+#define STRIDE_MAX_TICKETS  STRIDE_LARGE_NUMBER // keeps stride >= 1 << STRIDE_FRAC_BITS
+#define STRIDE_RENORM_PASS  (1LL << 48)         // renormalize passes past this
+#define STRIDE_WAKEUP_GAP   (STRIDE_ONE / 1000) // pass lead a wakeup needs to preempt
+// Processes are charged for the CPU time they actually used, in
+// units of 1 / (1 << STRIDE_CHARGE_SHIFT) timer ticks: a full tick
+// costs one stride.
+#define STRIDE_CHARGE_SHIFT 10
+#define STRIDE_CHARGE_TICK  (1 << STRIDE_CHARGE_SHIFT)
+
+// Load balancing, see loadbalance(): every BALANCE_INTERVAL ticks a
+// CPU pulls work from the one with the most tickets if it has fewer
+// by more than 1/BALANCE_IMBALANCE of those. Processes that ran in the
+// last BALANCE_HOT_TICKS ticks are considered cache-hot and stay put.
+#define BALANCE_INTERVAL  (HZ / 10)
+#define BALANCE_IMBALANCE 4
+#define BALANCE_HOT_TICKS 2
+
+// Scheduling policies for stride-class processes, see set_sched_policy().
+// SCHED_POLICY picks the one the kernel boots with; override it from
+// CFLAGS, e.g. make CFLAGS+=-DSCHED_POLICY=SCHED_LOTTERY.
+#define SCHED_STRIDE  0
+#define SCHED_LOTTERY 1
+#ifndef SCHED_POLICY
+#define SCHED_POLICY SCHED_STRIDE
+#endif
+
+// Real-time FIFO priorities run from 1 to RT_NPRIO, higher first.
+// Together they may use at most RT_RUNTIME_PCT percent of each CPU
+// per second while stride processes are waiting for it.
+#define RT_NPRIO       8
+#define RT_RUNTIME_PCT 95
+#define RT_RUNTIME     (HZ * STRIDE_CHARGE_TICK / 100 * RT_RUNTIME_PCT)
+
+struct runqueue;
+struct stride_group;
+
+struct proc *remove_min(struct runqueue *rq);
+void update_pass_value(struct proc *proc, uint charge);
+void update_global_pass(struct runqueue *rq, uint charge);
+void insert(struct runqueue *rq, struct proc *current);
+void stride_join(struct runqueue *rq, struct proc *proc);
+void stride_leave(struct runqueue *rq, struct proc *proc);
+int assign_tickets(int tickets);
+int assign_quantum(int quantum);
+int assign_rtprio(int prio);
+int set_sched_policy(int id);
+int stride_group_create(int parent, int tickets);
+int stride_group_tickets(int gid, int tickets);
+int stride_group_join(int gid);
+int stride_group_destroy(int gid);
+int stride_group_gang(int gid, int on);
 void initialize_stride_info(struct proc *proc);
 
 struct stride_info
 {
-  int stride;           // Stride value of the process
-  int tickets;          // Tickets given to the process
+  uint stride;          // Stride value of the process (fixed point)
+  int tickets;          // Tickets given to the process (in its group's currency)
+  int funding;          // tickets converted to base currency through the groups
+  uint group_gen;       // ptable.group_gen that funding was computed at
+  int active;           // Counted in its group's active tickets
   long long pass_value; // Pass value of the process
+  long long remain;     // pass_value - global pass, saved while off the run queue
 };
 
 //PAGEBREAK: 17
@@ -81,7 +146,30 @@ struct proc
   char name[16];              // Process name (debugging)
   /* stride scheduling */
   struct list_head queue_elem;    // Linked list element
+  int rq_index;                   // Slot in runqueue heap, -1 if not queued
+  int cpu;                        // Index of the CPU whose run queue owns us
+  int quantum;                    // Timer ticks to run before being preempted
+  int slice;                      // Ticks left of the current quantum
+  uint affinity;                  // CPUs this process may run on, bit per CPU
+  int rtprio;                     // Real-time FIFO priority, 0 for stride
+  struct list_head rt_elem;       // Entry in a runqueue rt list
+  struct list_head gang_elem;     // Entry in its group's queued list for its CPU
+  struct hlist_node sleep_elem;   // Entry in ptable sleep-channel hash bucket
+  struct hlist_node pid_elem;     // Entry in ptable pid hash bucket
+  struct list_head children;      // Processes whose parent is us
+  struct list_head sibling;       // Entry in parent->children
   struct stride_info stride_info; // Stride scheduling information
+  struct stride_group *group;     // Stride group, 0 if directly under the root
+  /* scheduling statistics, see getschedstat() */
+  unsigned long long run_cycles;     // TSC cycles spent RUNNING
+  unsigned long long wait_cycles;    // TSC cycles spent RUNNABLE
+  unsigned long long runnable_since; // TSC when last made RUNNABLE
+  uint npicked;                      // Times chosen by scheduler()
+  uint nvcsw;                        // Switches away to sleep or exit
+  uint nivcsw;                       // Switches away while still RUNNABLE
+  uint nmigrations;                  // Moves to another CPU's run queue
+  uint last_ran;                     // ticks when it last left a CPU
+  int yielded;                       // Gave up the CPU by sched_yield()
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,87 @@
+// Print per-process scheduling statistics and compare the share of
+// CPU time each process got with its share of the tickets, followed
+// by the load and migration counters of each CPU.
+// Usage: schedstat [pid...]  (no pids: every process, up to MAXSTATS)
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "schedstat.h"
+
+#define MAXSTATS 64
+
+struct schedstat stats[MAXSTATS];
+int nstats;
+
+// Cycle counts are printed in units of 2^20 cycles ("Mcyc"),
+// which keeps them in 32 bits and avoids 64-bit division.
+static uint
+mcycles(unsigned long long c)
+{
+  return (uint)(c >> 20);
+}
+
+// part as a share of total, in per mille. Both are scaled down
+// until part * 1000 fits in 32 bits.
+static uint
+permille(uint part, uint total)
+{
+  while(total > 0xffffffff / 1000){
+    part >>= 1;
+    total >>= 1;
+  }
+  return total ? part * 1000 / total : 0;
+}
+
+static void
+add(int pid)
+{
+  if(nstats >= MAXSTATS)
+    return;
+  if(getschedstat(pid, &stats[nstats]) == 0)
+    nstats++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pids[MAXSTATS];
+  uint run, totrun, tottix;
+  struct schedstat *st;
+  struct rqstat rq;
+
+  if(argc > 1){
+    for(i = 1; i < argc; i++)
+      add(atoi(argv[i]));
+  } else {
+    n = getpids(pids, MAXSTATS);
+    for(i = 0; i < n; i++)
+      add(pids[i]);
+  }
+  if(nstats == 0){
+    printf(2, "schedstat: no such process\n");
+    exit();
+  }
+
+  totrun = tottix = 0;
+  for(st = stats; st < &stats[nstats]; st++){
+    totrun += mcycles(st->run_cycles);
+    tottix += st->funding;
+  }
+  if(stats[0].tsc_per_tick)
+    printf(1, "%d cycles per tick\n", stats[0].tsc_per_tick);
+  printf(1, "pid\ttickets\tfunding\tpicked\tvol\tinvol\tmigr\trunMcyc\twaitMcyc\tshare\tticket share (per mille)\n");
+  for(st = stats; st < &stats[nstats]; st++){
+    run = mcycles(st->run_cycles);
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+           st->pid, st->tickets, st->funding, st->npicked, st->nvcsw,
+           st->nivcsw, st->nmigrations, run, mcycles(st->wait_cycles),
+           permille(run, totrun), permille(st->funding, tottix));
+  }
+
+  printf(1, "cpu\tqueued\trt\ttickets\tsteals\tbalanced\n");
+  for(i = 0; getrqstat(i, &rq) == 0; i++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\n", rq.cpu, rq.nqueued, rq.nrt,
+           rq.tickets, rq.nsteals, rq.nbalanced);
+  exit();
+}
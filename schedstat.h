@@ -0,0 +1,27 @@
+// Per-process scheduling statistics, see getschedstat().
+// Cycle counts are TSC cycles; tsc_per_tick converts them to
+// timer ticks (it is 0 until the kernel has measured it).
+struct schedstat {
+  int pid;
+  int tickets;                    // Tickets in the process' group currency
+  int funding;                    // Tickets converted to base currency
+  int quantum;                    // Timer ticks per quantum
+  uint npicked;                   // Times chosen by the scheduler
+  uint nvcsw;                     // Voluntary switches (sleep, exit)
+  uint nivcsw;                    // Involuntary switches (preempted)
+  uint nmigrations;               // Moves to another CPU
+  uint tsc_per_tick;              // TSC cycles per timer tick
+  unsigned long long run_cycles;  // Time spent RUNNING
+  unsigned long long wait_cycles; // Time spent RUNNABLE on a run queue
+};
+
+// Load of a CPU's run queue and how many processes moved to it,
+// see getrqstat().
+struct rqstat {
+  int cpu;
+  int nqueued;    // Stride-class processes waiting to run
+  int nrt;        // Real-time processes waiting to run
+  int tickets;    // Global tickets (queued and running stride clients)
+  uint nsteals;   // Processes taken from other CPUs while idle
+  uint nbalanced; // Processes pulled over by the load balancer
+};
@@ -0,0 +1,66 @@
+// Record scheduler trace events to a file for offline analysis.
+// Usage: schedtrace file [ticks]
+// Turns tracing on, drains the kernel's per-CPU trace rings into
+// file every tick for the given number of ticks (default 100),
+// then turns tracing off. The file is an array of struct traceev.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "trace.h"
+
+#define NBUF 128
+
+struct traceev buf[NBUF];
+
+// Copy everything the kernel has recorded so far to fd.
+// Returns the number of events written, or -1.
+static int
+drain(int fd)
+{
+  int n, total;
+
+  total = 0;
+  while((n = traceread(buf, NBUF)) > 0){
+    if(write(fd, buf, n*sizeof(buf[0])) != n*sizeof(buf[0]))
+      return -1;
+    total += n;
+  }
+  return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, ticks, start, total, lost;
+
+  if(argc < 2){
+    printf(2, "usage: schedtrace file [ticks]\n");
+    exit();
+  }
+  ticks = argc > 2 ? atoi(argv[2]) : 100;
+  if((fd = open(argv[1], O_CREATE|O_WRONLY)) < 0){
+    printf(2, "schedtrace: cannot open %s\n", argv[1]);
+    exit();
+  }
+
+  tracectl(1);
+  n = total = 0;
+  start = uptime();
+  while(uptime() - start < ticks){
+    sleep(1);
+    if((n = drain(fd)) < 0)
+      break;
+    total += n;
+  }
+  lost = tracectl(0);
+  if(n >= 0 && (n = drain(fd)) >= 0)
+    total += n;
+  close(fd);
+
+  if(n < 0)
+    printf(2, "schedtrace: write %s failed\n", argv[1]);
+  printf(1, "%d events, %d lost\n", total, lost);
+  exit();
+}
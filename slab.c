@@ -0,0 +1,212 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A cache hands out objects of one size, carved out of slabs:
+// pages from kalloc() that start with a struct slab header.
+// The slab an object belongs to is found by rounding its
+// address down to a page. A cache grows by a page whenever all
+// its slabs are full, and gives a slab back to kalloc() when it
+// empties and the cache already has an empty one in reserve.
+//
+// In front of the slabs each CPU keeps a few free objects that
+// it allocates from and frees to without taking a lock; the
+// cache lock is only taken to move SLAB_BATCH of them at a time.
+// Objects are not constructed: kmem_cache_alloc() returns them
+// as the last user left them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;        // In the cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *free;               // Free objects, linked through their first word
+  uint inuse;
+};
+
+#define SLAB_ALIGN  8
+#define SLAB_HDR    ((sizeof(struct slab) + SLAB_ALIGN-1) & ~(SLAB_ALIGN-1))
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache *caches;
+} slabs;
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size)
+{
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = (size + SLAB_ALIGN-1) & ~(SLAB_ALIGN-1);
+  if(c->size < sizeof(void*) || c->size > PGSIZE - SLAB_HDR)
+    panic("kmem_cache_init");
+  c->perslab = (PGSIZE - SLAB_HDR) / c->size;
+  initlock(&c->lock, name);
+
+  acquire(&slabs.lock);
+  c->next = slabs.caches;
+  slabs.caches = c;
+  release(&slabs.lock);
+}
+
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+slab_unlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+// Carve a new page into free objects.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLAB_HDR + i*c->size;
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  c->nslab++;
+  return s;
+}
+
+// Take one object out of the slabs.
+// Caller must hold c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0){
+    if((s = c->empty) != 0)
+      c->empty = 0;
+    else if((s = slab_grow(c)) == 0)
+      return 0;
+    slab_link(c, s);
+  }
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  if(s->free == 0)
+    slab_unlink(c, s);
+  c->ninuse++;
+  return obj;
+}
+
+// Return an object to its slab.
+// Caller must hold c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->free == 0)
+    slab_link(c, s);
+  *(void**)obj = s->free;
+  s->free = obj;
+  c->ninuse--;
+  if(--s->inuse > 0)
+    return;
+  slab_unlink(c, s);
+  if(c->empty == 0){
+    c->empty = s;
+    return;
+  }
+  c->nslab--;
+  kfree((char*)s);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slabmag *m;
+  void *obj;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < SLAB_BATCH && (obj = slab_get(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  popcli();
+  return obj;
+}
+
+// Free an object allocated from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slabmag *m;
+
+  if(((struct slab*)PGROUNDDOWN((uint)obj))->cache != c)
+    panic("kmem_cache_free");
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == SLAB_MAG){
+    acquire(&c->lock);
+    while(m->n > SLAB_MAG - SLAB_BATCH)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  popcli();
+}
+
+// Number of pages held by all caches.
+uint
+slabpages(void)
+{
+  struct kmem_cache *c;
+  uint n;
+
+  n = 0;
+  acquire(&slabs.lock);
+  for(c = slabs.caches; c; c = c->next)
+    n += c->nslab;
+  release(&slabs.lock);
+  return n;
+}
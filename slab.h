@@ -0,0 +1,26 @@
+// Object caches for fixed-size kernel structures, see slab.c.
+
+#define SLAB_MAG    8   // free objects each CPU keeps per cache
+#define SLAB_BATCH  4   // objects moved between a CPU and the slabs at once
+
+struct slab;
+
+// Free objects of one CPU. Only that CPU touches it,
+// and only with interrupts off.
+struct slabmag {
+  void *obj[SLAB_MAG];
+  int n;
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;              // Object size, rounded up
+  uint perslab;           // Objects per slab
+  struct spinlock lock;   // Protects the slab lists and counters
+  struct slab *partial;   // Slabs with both free and used objects
+  struct slab *empty;     // A slab with no objects in use, or 0
+  uint nslab;             // Pages held
+  uint ninuse;            // Objects out of the slabs, cached per CPU included
+  struct kmem_cache *next; // In the list of all caches
+  struct slabmag mag[NCPU];
+};
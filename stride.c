@@ -1,59 +1,229 @@
+// Stride scheduling fairness benchmark.
+//
+// usage: stride [-n nproc] [-t tickets] [-m mix] [-d ticks] [-p policy]
+//   -n nproc    number of processes (default 3, at most MAXPROC)
+//   -t tickets  "linear" (100, 200, 300, ...), "equal" (100 each),
+//               "exp" (100, 200, 400, ...) or a list "100,250,50";
+//               a list shorter than nproc is repeated (default linear)
+//   -m mix      behaviour of each process, a string repeated over them:
+//               c  CPU-bound, spins
+//               i  I/O-bound, small synchronous file writes
+//               s  sleepy, runs for a tick then sleeps for two
+//               (default "c")
+//   -d ticks    measuring time in timer ticks (default 500)
+//   -p policy   "stride" or "lottery": run under that scheduling
+//               policy and switch back afterwards (default: as is)
+//
+// The CPU time each process got is taken from getschedstat().
+// Tickets only divide the time of the CPU a process is queued on,
+// so all processes are pinned to CPU 0 with setaffinity(); on
+// several CPUs they would otherwise each get a CPU of their own,
+// whatever their tickets. Only CPU-bound processes always want to
+// run, so fairness is judged among them: each one's share of their CPU time should
+// match its share of their tickets. Reported are the largest
+// absolute error in quanta (timer ticks) and Jain's fairness index
+// of CPU time per ticket, which is 1 when shares are exact.
+
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "fcntl.h"
+#include "schedstat.h"
 
-#define N 3
-#define PRINT_TIME 100000000
-#define MAX_COUNTER 500000000
+#define MAXPROC 32
 
-void stridetest(void)
+typedef unsigned long long u64;
+
+int nproc = 3;
+int duration = 500;
+char *dist = "linear";
+char *mix = "c";
+char *policy;
+
+int tickets[MAXPROC];
+char behaviour[MAXPROC];
+int pids[MAXPROC];
+u64 run[MAXPROC]; // CPU cycles used while measuring
+
+// Unsigned 64-bit division; user programs have no libgcc.
+static u64 div64(u64 n, u64 d)
 {
-  int n, pid;
+  u64 q = 0, bit = 1;
 
-  printf(1, "stride scheduling test\n");
+  if (d == 0)
+    return 0;
+  while (d < n && !(d >> 63))
+  {
+    d <<= 1;
+    bit <<= 1;
+  }
+  while (bit)
+  {
+    if (n >= d)
+    {
+      n -= d;
+      q |= bit;
+    }
+    d >>= 1;
+    bit >>= 1;
+  }
+  return q;
+}
 
-  for (n = 0; n < N; n++)
+static void usage(void)
+{
+  printf(2, "usage: stride [-n nproc] [-t linear|equal|exp|t1,t2,...] [-m mix] [-d ticks] [-p stride|lottery]\n");
+  exit();
+}
+
+// Fill tickets[] from the -t argument.
+static void parse_tickets(void)
+{
+  int i, n, list[MAXPROC];
+  char *s;
+
+  for (i = 0; i < nproc; i++)
   {
-    pid = fork();
-    if (pid < 0)
+    if (strcmp(dist, "linear") == 0)
+      tickets[i] = 100 * (i + 1);
+    else if (strcmp(dist, "equal") == 0)
+      tickets[i] = 100;
+    else if (strcmp(dist, "exp") == 0)
+      tickets[i] = 100 << (i < 12 ? i : 12);
+    else
       break;
-    if (pid == 0)
+  }
+  if (i == nproc)
+    return;
+
+  n = 0;
+  for (s = dist; *s && n < MAXPROC; n++)
+  {
+    if (*s < '0' || *s > '9')
+      usage();
+    list[n] = atoi(s);
+    while (*s >= '0' && *s <= '9')
+      s++;
+    if (*s == ',')
+      s++;
+  }
+  if (n == 0)
+    usage();
+  for (i = 0; i < nproc; i++)
+    tickets[i] = list[i % n];
+}
+
+// Name of the file that I/O-bound process i writes to.
+static void iofile(char *name, int i)
+{
+  strcpy(name, "strideA");
+  name[6] += i;
+}
+
+// Run a CPU-bound, I/O-bound or sleepy workload until killed.
+static void work(int i)
+{
+  volatile uint counter = 0;
+  char name[8], buf[512];
+  int fd, n, t;
+
+  switch (behaviour[i])
+  {
+  case 'i':
+    iofile(name, i);
+    memset(buf, i, sizeof(buf));
+    for (;;)
+    {
+      if ((fd = open(name, O_CREATE | O_WRONLY)) < 0)
+        exit();
+      // each write is a transaction that waits for the disk
+      for (n = 0; n < 8; n++)
+        write(fd, buf, sizeof(buf));
+      close(fd);
+    }
+  case 's':
+    for (;;)
     {
-      long long counter = 0;
-      int print_counter = PRINT_TIME;
+      t = uptime();
+      while (uptime() == t)
+        counter++;
+      sleep(2);
+    }
+  default:
+    for (;;)
+      counter++;
+  }
+}
+
+// Print n / d as a decimal fraction with three digits.
+static void printfrac(u64 n, u64 d)
+{
+  uint v = d ? (uint)div64(n * 1000, d) : 0;
 
-      int tickets = 100 * (n + 1);
+  printf(1, "%d.%d%d%d", v / 1000, v / 100 % 10, v / 10 % 10, v % 10);
+}
 
-      // please implement the stride() system call
-      stride(tickets);
-      uint start_ticks = uptime();
-      uint end_ticks;
-      int first = 1;
+void stridetest(void)
+{
+  struct schedstat st;
+  int i, n, ncpu, start, p[2];
+  u64 cpurun, cputix, expect, err, maxerr, x, sumx, sumx2;
+  uint per_tick;
+  char c, name[8];
 
-      while (counter <= MAX_COUNTER)
+  printf(1, "stride fairness benchmark: %d processes, %d ticks\n", nproc, duration);
+
+  // Children block on the pipe until all of them exist.
+  if (pipe(p) < 0)
+  {
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  for (n = 0; n < nproc; n++)
+  {
+    pids[n] = fork();
+    if (pids[n] < 0)
+    {
+      printf(1, "fork failed\n");
+      break;
+    }
+    if (pids[n] == 0)
+    {
+      if (setaffinity(getpid(), 1) < 0)
       {
-        counter++;
-        print_counter--;
-
-        if (print_counter == 0)
-        {
-          if (first)
-          {
-            end_ticks = uptime();
-            printf(1, "PID: %d (tickets: %d), ", getpid(), tickets);
-            printf(1, "it takes %d milliseconds to complete %d additions.\n", (end_ticks - start_ticks) * 10, counter);
-            first = 0;
-          }
-          print_counter = PRINT_TIME;
-        }
+        printf(1, "setaffinity failed\n");
+        exit();
       }
-
-      printf(1, "PID: %d terminated\n", getpid());
-      exit();
+      stride(tickets[n]);
+      close(p[1]);
+      read(p[0], &c, 1);
+      close(p[0]);
+      work(n);
     }
   }
+  close(p[0]);
+  close(p[1]);
+  if (n == 0)
+    exit();
 
-  for (; n > 0; n--)
+  for (i = 0; i < n; i++)
+  {
+    getschedstat(pids[i], &st);
+    run[i] = st.run_cycles;
+  }
+  start = uptime();
+  sleep(duration);
+  for (i = 0; i < n; i++)
+  {
+    getschedstat(pids[i], &st);
+    run[i] = st.run_cycles - run[i];
+  }
+  duration = uptime() - start;
+  per_tick = st.tsc_per_tick;
+
+  for (i = 0; i < n; i++)
+    kill(pids[i]);
+  for (i = 0; i < n; i++)
   {
     if (wait() < 0)
     {
@@ -61,18 +231,129 @@ void stridetest(void)
       exit();
     }
   }
-
   if (wait() != -1)
   {
     printf(1, "wait got too many\n");
     exit();
   }
 
+  cpurun = cputix = 0;
+  ncpu = 0;
+  for (i = 0; i < n; i++)
+  {
+    if (behaviour[i] != 'c')
+      continue;
+    cpurun += run[i];
+    cputix += tickets[i];
+    ncpu++;
+  }
+
+  printf(1, "pid\tkind\ttickets\tticks\tshare\twanted\n");
+  maxerr = sumx = sumx2 = 0;
+  for (i = 0; i < n; i++)
+  {
+    printf(1, "%d\t%c\t%d\t", pids[i], behaviour[i], tickets[i]);
+    if (per_tick)
+      printfrac(run[i], per_tick);
+    else
+      printf(1, "?");
+    printf(1, "\t");
+    if (behaviour[i] != 'c')
+    {
+      printf(1, "-\t-\n");
+      continue;
+    }
+    printfrac(run[i], cpurun);
+    printf(1, "\t");
+    printfrac(tickets[i], cputix);
+    printf(1, "\n");
+
+    expect = div64(cpurun * tickets[i], cputix);
+    err = run[i] > expect ? run[i] - expect : expect - run[i];
+    if (err > maxerr)
+      maxerr = err;
+    // CPU time per ticket, in units of 256 cycles to keep the
+    // sum of squares in 64 bits
+    x = div64(run[i] >> 8, tickets[i]);
+    sumx += x;
+    sumx2 += x * x;
+  }
+
+  if (cputix == 0)
+  {
+    printf(1, "no CPU-bound processes to compare\n");
+  }
+  else
+  {
+    printf(1, "max error: ");
+    if (per_tick)
+    {
+      printfrac(maxerr, per_tick);
+      printf(1, " quanta over %d ticks\n", duration);
+    }
+    else
+    {
+      printf(1, "%d Mcycles\n", (uint)(maxerr >> 20));
+    }
+    printf(1, "Jain's fairness index: ");
+    printfrac(sumx * sumx, ncpu * sumx2);
+    printf(1, "\n");
+  }
   printf(1, "stride scheduling test OK\n");
+
+  for (i = 0; i < n; i++)
+  {
+    if (behaviour[i] == 'i')
+    {
+      iofile(name, i);
+      unlink(name);
+    }
+  }
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
+  int i;
+
+  for (i = 1; i + 1 < argc; i += 2)
+  {
+    if (strcmp(argv[i], "-n") == 0)
+      nproc = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-t") == 0)
+      dist = argv[i + 1];
+    else if (strcmp(argv[i], "-m") == 0)
+      mix = argv[i + 1];
+    else if (strcmp(argv[i], "-d") == 0)
+      duration = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-p") == 0)
+      policy = argv[i + 1];
+    else
+      usage();
+  }
+  if (i != argc || nproc < 1 || nproc > MAXPROC || duration < 1 || mix[0] == 0)
+    usage();
+
+  parse_tickets();
+  for (i = 0; i < nproc; i++)
+  {
+    behaviour[i] = mix[i % strlen(mix)];
+    if (behaviour[i] != 'c' && behaviour[i] != 'i' && behaviour[i] != 's')
+      usage();
+  }
+
+  if (policy == 0)
+  {
+    stridetest();
+    exit();
+  }
+  if (strcmp(policy, "stride") == 0)
+    i = schedpolicy(0);
+  else if (strcmp(policy, "lottery") == 0)
+    i = schedpolicy(1);
+  else
+    usage();
+  printf(1, "policy: %s\n", policy);
   stridetest();
+  schedpolicy(i);
   exit();
 }
@@ -69,6 +69,23 @@ argptr(int n, char **pp, int size)
   return 0;
 }
 
+// Like argptr(), for a block of memory the kernel is going to
+// write. Its copy-on-write pages are copied now: the kernel writes
+// them holding locks, where a page fault must not happen, let
+// alone fail. If there is no memory for the copies the process
+// is killed.
+int
+argoutptr(int n, char **pp, int size)
+{
+  if(argptr(n, pp, size) < 0)
+    return -1;
+  if(cowbreak(myproc()->pgdir, (uint)*pp, size) < 0){
+    myproc()->killed = 1;
+    return -1;
+  }
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -104,6 +121,23 @@ extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_stride(void);
+extern int sys_stride_group_create(void);
+extern int sys_stride_group_tickets(void);
+extern int sys_stride_group_join(void);
+extern int sys_stride_group_leave(void);
+extern int sys_stride_group_destroy(void);
+extern int sys_quantum(void);
+extern int sys_getschedstat(void);
+extern int sys_tracectl(void);
+extern int sys_traceread(void);
+extern int sys_yield(void);
+extern int sys_setaffinity(void);
+extern int sys_rtprio(void);
+extern int sys_schedpolicy(void);
+extern int sys_stride_group_gang(void);
+extern int sys_getrqstat(void);
+extern int sys_getkmemstat(void);
+extern int sys_getpids(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -128,6 +162,23 @@ static int (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_stride]  sys_stride,
+[SYS_stride_group_create]  sys_stride_group_create,
+[SYS_stride_group_tickets] sys_stride_group_tickets,
+[SYS_stride_group_join]    sys_stride_group_join,
+[SYS_stride_group_leave]   sys_stride_group_leave,
+[SYS_stride_group_destroy] sys_stride_group_destroy,
+[SYS_quantum]              sys_quantum,
+[SYS_getschedstat]         sys_getschedstat,
+[SYS_tracectl]             sys_tracectl,
+[SYS_traceread]            sys_traceread,
+[SYS_yield]                sys_yield,
+[SYS_setaffinity]          sys_setaffinity,
+[SYS_rtprio]               sys_rtprio,
+[SYS_schedpolicy]          sys_schedpolicy,
+[SYS_stride_group_gang]    sys_stride_group_gang,
+[SYS_getrqstat]            sys_getrqstat,
+[SYS_getkmemstat]          sys_getkmemstat,
+[SYS_getpids]              sys_getpids,
 };
 
 void
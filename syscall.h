@@ -20,4 +20,21 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
-#define SYS_stride 22
\ No newline at end of file
+#define SYS_stride 22
+#define SYS_stride_group_create  23
+#define SYS_stride_group_tickets 24
+#define SYS_stride_group_join    25
+#define SYS_stride_group_leave   26
+#define SYS_stride_group_destroy 27
+#define SYS_quantum 28
+#define SYS_getschedstat 29
+#define SYS_tracectl 30
+#define SYS_traceread 31
+#define SYS_yield 32
+#define SYS_setaffinity 33
+#define SYS_rtprio 34
+#define SYS_schedpolicy 35
+#define SYS_stride_group_gang 36
+#define SYS_getrqstat 37
+#define SYS_getkmemstat 38
+#define SYS_getpids 39
\ No newline at end of file
@@ -6,6 +6,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "schedstat.h"
+#include "trace.h"
+#include "kmemstat.h"
 
 int
 sys_fork(void)
@@ -90,13 +93,215 @@ sys_uptime(void)
   return xticks;
 }
 
-void
+int
 sys_stride(void)
 {
   int tickets;
   if(argint(0, &tickets) < 0)
-    return;
+    return -1;
 
   // call assign_ticket function in proc.c
-  assign_tickets(tickets);
-}
\ No newline at end of file
+  return assign_tickets(tickets);
+}
+
+// create a stride group funded by tickets of the parent group
+// (0 for the root); returns the new group id
+int
+sys_stride_group_create(void)
+{
+  int parent, tickets;
+
+  if(argint(0, &parent) < 0 || argint(1, &tickets) < 0)
+    return -1;
+  return stride_group_create(parent, tickets);
+}
+
+int
+sys_stride_group_tickets(void)
+{
+  int gid, tickets;
+
+  if(argint(0, &gid) < 0 || argint(1, &tickets) < 0)
+    return -1;
+  return stride_group_tickets(gid, tickets);
+}
+
+int
+sys_stride_group_join(void)
+{
+  int gid;
+
+  if(argint(0, &gid) < 0)
+    return -1;
+  return stride_group_join(gid);
+}
+
+// move the calling process back under the root
+int
+sys_stride_group_leave(void)
+{
+  return stride_group_join(0);
+}
+
+int
+sys_stride_group_destroy(void)
+{
+  int gid;
+
+  if(argint(0, &gid) < 0)
+    return -1;
+  return stride_group_destroy(gid);
+}
+
+// set the number of timer ticks the calling process
+// runs before it is preempted
+int
+sys_quantum(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return assign_quantum(n);
+}
+
+// copy the scheduling statistics of process pid to user memory
+int
+sys_getschedstat(void)
+{
+  int pid;
+  char *p;
+  struct schedstat st;
+
+  if(argint(0, &pid) < 0 || argoutptr(1, &p, sizeof(st)) < 0)
+    return -1;
+  if(getschedstat(pid, &st) < 0)
+    return -1;
+  return copyout(myproc()->pgdir, (uint)p, &st, sizeof(st));
+}
+
+// turn scheduler tracing on or off; returns the number
+// of events dropped since the last call
+int
+sys_tracectl(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  return tracectl(on);
+}
+
+// move up to n trace events into the user buffer
+int
+sys_traceread(void)
+{
+  int n;
+  struct traceev *buf;
+
+  if(argint(1, &n) < 0 || n < 0 || n > 65536)
+    return -1;
+  if(argoutptr(0, (void*)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return traceread((uint)buf, n);
+}
+
+// give up the CPU; the caller is charged only for
+// the part of its quantum it used
+int
+sys_yield(void)
+{
+  sched_yield();
+  return 0;
+}
+
+// restrict process pid to the CPUs set in mask
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+// move the calling process into the real-time FIFO class
+// at priority n, or back to stride scheduling if n is 0
+int
+sys_rtprio(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return assign_rtprio(n);
+}
+
+// switch all CPUs to scheduling policy n (0 stride,
+// 1 lottery); returns the previous policy
+int
+sys_schedpolicy(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return set_sched_policy(n);
+}
+
+// co-schedule the members of a stride group (on != 0)
+int
+sys_stride_group_gang(void)
+{
+  int gid, on;
+
+  if(argint(0, &gid) < 0 || argint(1, &on) < 0)
+    return -1;
+  return stride_group_gang(gid, on);
+}
+
+// copy the load and migration counters of a CPU to user memory
+int
+sys_getrqstat(void)
+{
+  int cpu;
+  char *p;
+  struct rqstat st;
+
+  if(argint(0, &cpu) < 0 || argoutptr(1, &p, sizeof(st)) < 0)
+    return -1;
+  if(getrqstat(cpu, &st) < 0)
+    return -1;
+  return copyout(myproc()->pgdir, (uint)p, &st, sizeof(st));
+}
+
+// copy the page allocator counters of a CPU to user memory
+int
+sys_getkmemstat(void)
+{
+  int cpu;
+  char *p;
+  struct kmemstat st;
+
+  if(argint(0, &cpu) < 0 || argoutptr(1, &p, sizeof(st)) < 0)
+    return -1;
+  if(getkmemstat(cpu, &st) < 0)
+    return -1;
+  return copyout(myproc()->pgdir, (uint)p, &st, sizeof(st));
+}
+
+// copy the pids of up to n processes to user memory;
+// returns how many were copied
+int
+sys_getpids(void)
+{
+  int n;
+  int *pids;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NPROC)
+    return -1;
+  if(argoutptr(0, (void*)&pids, n*sizeof(*pids)) < 0)
+    return -1;
+  return getpids((uint)pids, n);
+}
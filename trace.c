@@ -0,0 +1,118 @@
+// Scheduler event tracing.
+//
+// Each CPU records events into its own ring with interrupts off,
+// so a ring has a single producer and recording takes no lock:
+// the event is written before head is advanced, and a reader
+// only looks at slots between tail and head. Readers are
+// serialized by trace.lock and advance tail once they have
+// copied an event out. When a ring is full new events are
+// dropped and counted, so recording never waits for a reader.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trace.h"
+
+#define NTRACE 256  // events per CPU ring (power of 2)
+
+struct tracering {
+  struct traceev ev[NTRACE];
+  volatile uint head;  // next slot to write, advanced by its CPU
+  volatile uint tail;  // next slot to read, advanced by readers
+  uint lost;           // events dropped because the ring was full
+};
+
+struct {
+  struct spinlock lock;  // serializes readers
+  volatile int on;
+  struct tracering ring[NCPU];
+} trace;
+
+void
+traceinit(void)
+{
+  initlock(&trace.lock, "trace");
+}
+
+// Record an event on this CPU's ring if tracing is on.
+void
+traceevent(int type, int pid, int arg)
+{
+  struct tracering *r;
+  struct traceev *e;
+  int cpu;
+
+  if(!trace.on)
+    return;
+  pushcli();
+  cpu = cpuid();
+  r = &trace.ring[cpu];
+  if(r->head - r->tail >= NTRACE){
+    r->lost++;
+    popcli();
+    return;
+  }
+  e = &r->ev[r->head & (NTRACE-1)];
+  e->tsc = rdtsc();
+  e->type = type;
+  e->cpu = cpu;
+  e->pid = pid;
+  e->arg = arg;
+  __sync_synchronize();
+  r->head++;
+  popcli();
+}
+
+// Turn tracing on or off. Returns the number of events
+// dropped since the last call, and resets the count.
+int
+tracectl(int on)
+{
+  struct tracering *r;
+  int lost;
+
+  acquire(&trace.lock);
+  trace.on = on;
+  lost = 0;
+  for(r = trace.ring; r < &trace.ring[NCPU]; r++){
+    lost += r->lost;
+    r->lost = 0;
+  }
+  release(&trace.lock);
+  return lost;
+}
+
+// Move up to n recorded events to user address addr, taking them
+// from each CPU's ring in turn. They are gathered a few at a time
+// under trace.lock and copied out once it is released.
+// Returns the number of events copied, or -1 if addr is bad.
+int
+traceread(uint addr, int n)
+{
+  struct traceev ev[16];
+  struct tracering *r;
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    m = 0;
+    acquire(&trace.lock);
+    for(r = trace.ring; r < &trace.ring[NCPU]; r++){
+      while(m < NELEM(ev) && i + m < n && r->tail != r->head){
+        __sync_synchronize();
+        ev[m++] = r->ev[r->tail & (NTRACE-1)];
+        __sync_synchronize();
+        r->tail++;
+      }
+    }
+    release(&trace.lock);
+    if(m == 0)
+      break;
+    if(copyout(myproc()->pgdir, addr + i*sizeof(ev[0]), ev, m*sizeof(ev[0])) < 0)
+      return -1;
+  }
+  return i;
+}
@@ -0,0 +1,19 @@
+// Scheduler trace events, recorded by the kernel into per-CPU
+// rings and read out with traceread(); see trace.c.
+
+#define TRACE_PICK      1  // scheduler chose pid; arg: processes left queued
+#define TRACE_SWITCHIN  2  // swtch to pid; arg: quantum in ticks
+#define TRACE_SWITCHOUT 3  // pid switched back to scheduler; arg: its state
+#define TRACE_WAKEUP    4  // pid made RUNNABLE; arg: CPU it is queued on
+#define TRACE_SLEEP     5  // pid going to sleep; arg: low bits of chan
+#define TRACE_FORK      6  // pid forked; arg: child pid
+#define TRACE_EXIT      7  // pid exiting
+#define TRACE_TICKETS   8  // pid changed its tickets; arg: new tickets
+
+struct traceev {
+  unsigned long long tsc; // rdtsc() on cpu when recorded
+  int type;               // TRACE_*
+  int cpu;                // CPU that recorded the event
+  int pid;
+  int arg;
+};
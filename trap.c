@@ -13,6 +13,8 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+uint tsc_per_tick;  // TSC cycles per timer tick, 0 until measured
+static unsigned long long last_tick_tsc;
 
 void
 tvinit(void)
@@ -32,6 +34,25 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Measure the TSC against the timer, smoothing out
+// ticks that were delayed. Called on every cpu0 tick
+// with tickslock held.
+static void
+tsctick(void)
+{
+  unsigned long long now = rdtsc();
+  uint delta;
+
+  if(last_tick_tsc != 0){
+    delta = now - last_tick_tsc;
+    if(tsc_per_tick == 0)
+      tsc_per_tick = delta;
+    else
+      tsc_per_tick = tsc_per_tick - tsc_per_tick/4 + delta/4;
+  }
+  last_tick_tsc = now;
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
@@ -43,6 +64,9 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    // A process woken by this system call may deserve the CPU more.
+    if(resched_pending())
+      yield();
     return;
   }
 
@@ -50,10 +74,12 @@ trap(struct trapframe *tf)
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
+      tsctick();
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
     }
+    loadbalance();
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -71,6 +97,12 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Another CPU queued work for us. If we are idle the
+    // scheduler loop picks it up once we return from here;
+    // otherwise need_resched says whether to preempt below.
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -78,6 +110,19 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A write to a copy-on-write page, by the process or by the
+    // kernel on its behalf, gets the process its own copy.
+    // The kernel may fault holding locks, so it must go straight
+    // back to the faulting instruction, not on to yield() below.
+    if(myproc() && (tf->err & FEC_WR) &&
+       cowfault(myproc()->pgdir, rcr2()) == 0){
+      if((tf->cs&3) != DPL_USER)
+        return;
+      break;
+    }
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -100,11 +145,16 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU when its quantum of clock
+  // ticks is used up, or when a process woken up on this CPU
+  // should run before it.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+  if(myproc() && myproc()->state == RUNNING){
+    if(tf->trapno == T_IRQ0+IRQ_TIMER)
+      myproc()->slice--;
+    if(myproc()->slice <= 0 || resched_pending())
+      yield();
+  }
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
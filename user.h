@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct schedstat;
+struct rqstat;
+struct kmemstat;
+struct traceev;
 
 // system calls
 int fork(void);
@@ -23,7 +27,24 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
-void stride(int);
+int stride(int);
+int stride_group_create(int, int);
+int stride_group_tickets(int, int);
+int stride_group_join(int);
+int stride_group_leave(void);
+int stride_group_destroy(int);
+int quantum(int);
+int getschedstat(int, struct schedstat*);
+int tracectl(int);
+int traceread(struct traceev*, int);
+int yield(void);
+int setaffinity(int, uint);
+int rtprio(int);
+int schedpolicy(int);
+int stride_group_gang(int, int);
+int getrqstat(int, struct rqstat*);
+int getkmemstat(int, struct kmemstat*);
+int getpids(int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "kmemstat.h"
 
 char buf[8192];
 char name[3];
@@ -1373,6 +1374,120 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// open and close more files than the inode cache keeps, several
+// times over, so that cached inodes are evicted and read back in.
+// Round 0 creates the files, rounds 1 and 2 read them back, and
+// round 3 removes them.
+void
+manyinodes(void)
+{
+  int i, j, fd, ok;
+  char name[4], c;
+
+  printf(1, "many inodes test\n");
+  name[0] = 'i';
+  name[3] = '\0';
+  for(j = 0; j < 4; j++){
+    // the 50 is NINODE
+    for(i = 0; i < 2*50; i++){
+      name[1] = '0' + i / 10;
+      name[2] = '0' + i % 10;
+      c = i;
+      if(j == 3)
+        ok = unlink(name) == 0;
+      else if((fd = open(name, j == 0 ? O_CREATE|O_RDWR : O_RDONLY)) < 0)
+        ok = 0;
+      else {
+        if(j == 0)
+          ok = write(fd, &c, 1) == 1;
+        else
+          ok = read(fd, &c, 2) == 1 && c == i;
+        close(fd);
+      }
+      if(!ok){
+        printf(1, "many inodes: round %d failed on %s\n", j, name);
+        exit();
+      }
+    }
+  }
+  printf(1, "many inodes ok\n");
+}
+
+// unlink a file whose inode is cached but no longer referenced,
+// then create another. It may get the same inode number, and must
+// not see anything of the old file.
+void
+reuseinode(void)
+{
+  struct stat st;
+  int fd;
+
+  printf(1, "reuse inode test\n");
+  fd = open("reuse1", O_CREATE | O_RDWR);
+  if(fd < 0 || write(fd, "aaaaaaaaaa", 10) != 10){
+    printf(1, "reuse inode: write reuse1 failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("reuse1");
+
+  fd = open("reuse2", O_CREATE | O_RDWR);
+  if(fd < 0 || fstat(fd, &st) != 0 || st.type != T_FILE ||
+     st.nlink != 1 || st.size != 0 || read(fd, buf, sizeof(buf)) != 0){
+    printf(1, "reuse inode: reuse2 is not a new empty file\n");
+    exit();
+  }
+  close(fd);
+  unlink("reuse2");
+  printf(1, "reuse inode ok\n");
+}
+
+// hold more open files, across several processes, than the old
+// fixed file table had room for (NFILE was 100).
+void
+manyfiles(void)
+{
+  int ready[2], pids[12], i, n, fds[2];
+  char c;
+
+  printf(1, "many files test\n");
+  if(pipe(ready) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < 12; i++){
+    if((pids[i] = fork()) == 0){
+      // 6 pipes fill the rest of this process's NOFILE descriptors
+      close(ready[0]);
+      for(n = 0; n < 6 && pipe(fds) == 0; n++)
+        ;
+      c = n;
+      write(ready[1], &c, 1);
+      for(;;)
+        sleep(1000);
+    }
+  }
+
+  n = 0;
+  for(i = 0; i < 12; i++){
+    if(pids[i] > 0 && read(ready[0], &c, 1) == 1)
+      n += c;
+  }
+  for(i = 0; i < 12; i++){
+    if(pids[i] > 0){
+      kill(pids[i]);
+      wait();
+    }
+  }
+  close(ready[0]);
+  close(ready[1]);
+  if(n != 12*6){
+    printf(1, "many files: only %d of %d pipes\n", n, 12*6);
+    exit();
+  }
+  printf(1, "many files ok\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1411,6 +1526,219 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// after fork, parent and child share their pages copy-on-write;
+// each must go on seeing only what it wrote itself.
+void
+cowtest(void)
+{
+  char *a;
+  int i, pid;
+
+  printf(1, "cow test\n");
+  a = sbrk(4*4096);
+  if(a == (char*)-1){
+    printf(1, "cow sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 4*4096; i++)
+    a[i] = 'a';
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "cow fork failed\n");
+    exit();
+  }
+  for(i = 0; i < 4*4096; i += 2)
+    a[i] = pid == 0 ? 'c' : 'p';
+  sleep(1);
+  for(i = 0; i < 4*4096; i++){
+    if(a[i] != (i % 2 ? 'a' : pid == 0 ? 'c' : 'p')){
+      printf(1, "cow %s sees wrong data at %d\n", pid == 0 ? "child" : "parent", i);
+      exit();
+    }
+  }
+  if(pid == 0)
+    exit();
+  wait();
+  sbrk(-4*4096);
+  printf(1, "cow ok\n");
+}
+
+// read() into a buffer the child still shares with its parent:
+// the kernel, not the user program, makes the first write to it.
+void
+cowread(void)
+{
+  char *a;
+  int i, pid, fds[2];
+
+  printf(1, "cow read test\n");
+  a = sbrk(4096);
+  if(a == (char*)-1){
+    printf(1, "cow read sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 4096; i++)
+    a[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  memset(buf, 'c', 100);
+  if(write(fds[1], buf, 100) != 100){
+    printf(1, "cow read write failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "cow read fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(read(fds[0], a + 10, 100) != 100){
+      printf(1, "cow read read failed\n");
+      exit();
+    }
+    for(i = 0; i < 4096; i++){
+      if(a[i] != (i >= 10 && i < 110 ? 'c' : 'p')){
+        printf(1, "cow read child sees wrong data at %d\n", i);
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  wait();
+  for(i = 0; i < 4096; i++){
+    if(a[i] != 'p'){
+      printf(1, "cow read changed the parent's buffer at %d\n", i);
+      exit();
+    }
+  }
+  sbrk(-4096);
+  printf(1, "cow read ok\n");
+}
+
+// fork, then call pipe(&a[2]) in both processes without writing
+// to the stack in between, so that the kernel's copyout of the
+// descriptors is the first write to the shared stack page.
+// a[0] is where the return address would be, a[1] the argument.
+int
+forkpipe(int *a)
+{
+  int pid, nr;
+
+  nr = SYS_fork;
+  asm volatile("int %3\n\t"
+      "mov %%eax, %%edx\n\t"
+      "mov %%esp, %%ebx\n\t"
+      "mov %5, %%esp\n\t"
+      "mov %4, %%eax\n\t"
+      "int %3\n\t"
+      "mov %%ebx, %%esp" :
+      "=d" (pid), "+a" (nr), "=m" (*a) :
+      "n" (T_SYSCALL), "n" (SYS_pipe), "c" (a) :
+      "ebx", "memory");
+  return pid;
+}
+
+void
+cowpipe(void)
+{
+  int a[4], pid;
+  char c;
+
+  printf(1, "cow pipe test\n");
+  a[0] = 0;
+  a[1] = (int)&a[2];
+  a[2] = a[3] = -1;
+  pid = forkpipe(a);
+  if(pid < 0){
+    printf(1, "cow pipe fork failed\n");
+    exit();
+  }
+  if(a[2] < 0 || a[3] < 0){
+    printf(1, "cow pipe: pipe() failed in the %s\n", pid == 0 ? "child" : "parent");
+    exit();
+  }
+  c = pid == 0 ? 'c' : 'p';
+  if(write(a[3], &c, 1) != 1 || read(a[2], &c, 1) != 1 ||
+     c != (pid == 0 ? 'c' : 'p')){
+    printf(1, "cow pipe: %s's pipe does not work\n", pid == 0 ? "child" : "parent");
+    exit();
+  }
+  close(a[2]);
+  close(a[3]);
+  if(pid == 0)
+    exit();
+  wait();
+  printf(1, "cow pipe ok\n");
+}
+
+// Free pages: those in the buddy allocator, the per-CPU magazines
+// and the zeroed pool, plus those the object caches took from them.
+int
+freepages(struct kmemstat *st)
+{
+  int cpu, n;
+
+  n = 0;
+  for(cpu = 0; getkmemstat(cpu, st) == 0; cpu++)
+    n += st->nmag;
+  return n + st->nfreepage + st->nzeropool + st->nslab;
+}
+
+// shrinking memory shared copy-on-write must drop its references,
+// so that all of it is free again once both processes let go.
+void
+cowsbrk(void)
+{
+  struct kmemstat st;
+  char *a;
+  int i, pid, before, after, shared;
+
+  printf(1, "cow sbrk test\n");
+  before = freepages(&st);
+  shared = st.nshared;
+  a = sbrk(64*4096);
+  if(a == (char*)-1){
+    printf(1, "cow sbrk sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 64*4096; i += 4096)
+    a[i] = 'p';
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "cow sbrk fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < 32*4096; i += 4096)
+      a[i] = 'c';
+    sbrk(-64*4096);
+    exit();
+  }
+  wait();
+  sbrk(-64*4096);
+
+  // allow for page table pages, which are not freed when memory
+  // shrinks, and for pages idle CPUs are zeroing, which are in
+  // none of the counts
+  after = freepages(&st);
+  if(after < before - 8){
+    printf(1, "cow sbrk leaked %d pages\n", before - after);
+    exit();
+  }
+  if(st.nshared > shared){
+    printf(1, "cow sbrk: %d pages still shared\n", st.nshared - shared);
+    exit();
+  }
+  printf(1, "cow sbrk ok\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1792,7 +2120,14 @@ main(int argc, char *argv[])
   unlinkread();
   dirfile();
   iref();
+  manyinodes();
+  reuseinode();
+  manyfiles();
   forktest();
+  cowtest();
+  cowread();
+  cowpipe();
+  cowsbrk();
   bigdir(); // slow
 
   uio();
@@ -117,6 +117,16 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one arrives.
+// sti only takes effect after the following instruction,
+// so an interrupt that is already pending ends the hlt
+// instead of being taken before it.
+static inline void
+sti_hlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -144,6 +154,35 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+static inline unsigned long long
+rdtsc(void)
+{
+  unsigned long long tsc;
+
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+// Divide the 64-bit n by d and return the quotient.
+// The kernel is not linked with libgcc, so C division of
+// 64-bit values is not available. The quotient must fit
+// in 32 bits, otherwise the CPU raises a divide error.
+static inline uint
+divl64(unsigned long long n, uint d)
+{
+  uint q, r;
+
+  asm volatile("divl %4" : "=a" (q), "=d" (r) :
+               "a" ((uint)n), "d" ((uint)(n >> 32)), "rm" (d));
+  return q;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().